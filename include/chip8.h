@@ -1,21 +1,67 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
 #include "configuration.h"
 #include <stdbool.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdint.h>
 
 typedef struct chip8 chip8;
+typedef struct chip8Trace chip8Trace;
+
+//------------------------------------------------------------------------------------------
+// CHIP8 DECODED INSTRUCTION
+//------------------------------------------------------------------------------------------
+// Opcode with its operands already extracted
+typedef struct chip8Instruction {
+    unsigned short opcode;
+    unsigned short nnn;
+    unsigned char op;       // chip8_Op id, CHIP8_OP_DECODE while the slot is empty
+    unsigned char x;
+    unsigned char y;
+    unsigned char kk;
+    unsigned char n;
+    unsigned char block_len;  // slots in the block starting here, 0 if not built
+    unsigned char block_op;   // op run inside a block: op, or a fused op that also runs the next slot
+} chip8Instruction;
+
+void chip8_DecodeInstruction( unsigned short opcode, chip8Instruction *ins);
 
 //------------------------------------------------------------------------------------------
 // CHIP8 MEMORY
 //------------------------------------------------------------------------------------------
+#if CHIP8_MEM_SIZE % CHIP8_PAGE_SIZE || CHIP8_PAGE_SIZE % 2
+#error "RAM must be whole pages of whole instructions"
+#endif
+#define CHIP8_PAGE_COUNT (CHIP8_MEM_SIZE / CHIP8_PAGE_SIZE)
+
+// Reference counted RAM page, copied by the first write while shared.
+// refs is 0 for the static pages chip8_init starts from, which are never freed.
+typedef struct chip8Page {
+    int refs;
+    unsigned char bytes[CHIP8_PAGE_SIZE];
+} chip8Page;
+
 typedef struct chip8Mem {
-    unsigned char RAM[CHIP8_MEM_SIZE];
+    chip8Page *pages[CHIP8_PAGE_COUNT];
+    // decode cache, one slot per even address of RAM, cleared by chip8_SetMem.
+    // Allocated by the first run and freed by chip8_Release, forks build their own.
+    chip8Instruction *decoded;
+    // bumped whenever a decoded instruction is overwritten
+    unsigned int code_generation;
 } chip8Mem;
 
 // Memory functions
 void chip8_CheckMemIndexBound(int index);
 unsigned char chip8_GetMem (chip8Mem *memory, int index);
 void chip8_SetMem (chip8Mem *memory, int index, unsigned char val);
+// Pointer to len bytes at index, read straight from the page or copied into
+// scratch when they cross one. Bytes past the end of RAM wrap to 0.
+const unsigned char * chip8_GetMemSpan (chip8Mem *memory, int index, int len, unsigned char *scratch);
+void chip8_InvalidateMem (chip8Mem *memory, int index);
+// The decode cache, allocating it empty on first use
+chip8Instruction * chip8_GetDecoded (chip8Mem *memory);
 unsigned short chip8_FetchInstructionMem (chip8Mem *memory, int index);
 
 //------------------------------------------------------------------------------------------
@@ -53,9 +99,13 @@ void chip8_CheckStackBound ( int index );
 typedef struct chip8Keyboard {
     bool v_keyboard[CHIP8_KEYBOARD_SIZE];
     const char *map;
+    // Fx0A: waiting is set until chip8_PutKeyDown delivers a key, which
+    // Fx0A picks up from wait_key when it runs again
+    bool waiting;
+    bool wait_done;
+    unsigned char wait_key;
 } chip8Keyboard;
 
-char chip8_waitForKeyPress (chip8 *chip);
 void chip8_KeyboardSetKeyboardMap ( chip8Keyboard *keyboard, const char *map);
 int  chip8_MapKey    ( chip8Keyboard *keyboard, char key);
 void chip8_PutKeyDown( chip8Keyboard *keyboard, int key);
@@ -65,15 +115,48 @@ bool chip8_IsKeyDown ( chip8Keyboard *keyboard, int key);
 //------------------------------------------------------------------------------------------
 // CHIP8 SCREEN
 //------------------------------------------------------------------------------------------
+#if WIN_WIDTH != 64
+#error "chip8Screen packs a row into one 64-bit word"
+#endif
+#if WIN_HEIGHT > 32
+#error "chip8Screen tracks dirty rows in a 32-bit mask"
+#endif
+
+// One word per row, x = 0 is the most significant bit
 typedef struct chip8Screen {
-    bool pixle[WIN_HEIGHT][WIN_WIDTH];
+    uint64_t rows[WIN_HEIGHT];
+    // bumped by every draw or clear
+    unsigned int generation;
+    // bit y set when row y changed since chip8_ScreenTakeDirtyRows
+    uint32_t dirty_rows;
 } chip8Screen;
 
 void chip8_ScreenCheckBound (int x, int y);
 void chip8_SetScreenPixle( chip8Screen *screen, int x, int y);
 bool chip8_IsScreenPixleSet ( chip8Screen *screen, int x, int y);
+uint64_t chip8_GetScreenRow ( const chip8Screen *screen, int y);
+
+// XORs num sprite rows, rotated right by shift, into consecutive screen rows
+// and returns true on collision
+typedef bool (*chip8_SpriteBlitter) ( uint64_t *rows, const unsigned char *sprite, int num, int shift);
+// AVX2, SSE2 or scalar blitter, whichever the host CPU supports
+chip8_SpriteBlitter chip8_GetSpriteBlitter ( void );
 bool chip8_ScreenDrawSprite ( chip8Screen *screen, int x, int y, const char *sprite, int num);
 void chip8_ScreenClear (chip8Screen *screen);
+// Returns the dirty row mask and clears it
+uint32_t chip8_ScreenTakeDirtyRows ( chip8Screen *screen);
+
+//------------------------------------------------------------------------------------------
+// CHIP8 HOST
+//------------------------------------------------------------------------------------------
+// Callbacks into the program embedding the core. Any of them may be NULL.
+typedef struct chip8Host {
+    void *user;
+    // 00E0 or Dxyn changed the screen
+    void (*draw) ( void *user, const chip8Screen *screen);
+    // the sound timer started (on) or ran out, seen by chip8_TickTimers
+    void (*sound) ( void *user, bool on);
+} chip8Host;
 
 //------------------------------------------------------------------------------------------
 // CHIP8
@@ -84,12 +167,115 @@ struct chip8 {
     chip8Stack stack;
     chip8Keyboard keyboard;
     chip8Screen screen;
+    const chip8Host *host;
+    bool sound_on;
+    // xorshift64* state for Cxkk, never zero
+    uint64_t rng;
+    // execution trace, only recorded by builds with CHIP8_TRACE
+    chip8Trace *trace;
 };
 
+// Resets chip, a chip that was in use must be chip8_Release'd first
 void chip8_init( chip8 *chip );
+// Makes dst a copy of src sharing its RAM pages, dst must not be in use
+void chip8_Fork ( chip8 *dst, const chip8 *src);
+// Drops the RAM pages of chip
+void chip8_Release ( chip8 *chip);
 const char * chip8_ReadProgram( char *filename, long *filesize );
 void chip8_LoadProgram ( chip8 *chip, const char *buff, size_t size);
+// Attaches host callbacks, NULL runs headless
+void chip8_SetHost ( chip8 *chip, const chip8Host *host);
+// Seeds the Cxkk generator, equal seeds give equal RND sequences
+void chip8_Seed ( chip8 *chip, uint64_t seed);
+// Calls the host draw callback, for cores that clear or draw inline
+void chip8_ScreenChanged ( chip8 *chip);
+// Decrements the delay and sound timers, called at 60 Hz by the host
+void chip8_TickTimers ( chip8 *chip);
+
+// Bytes in a savestate: header, RAM, registers, stack, keyboard, screen rows, RND state
+#define CHIP8_STATE_SIZE (8 + CHIP8_MEM_SIZE + V_REGISTER_COUNT + 7 + 2 * CHIP8_STACK_SIZE + \
+                          CHIP8_KEYBOARD_SIZE + 3 + 8 * WIN_HEIGHT + 8)
+// Writes the machine state into buff, returns CHIP8_STATE_SIZE or 0 when size
+// is too small. The keyboard map, host and decode cache are not saved.
+size_t chip8_SaveState ( const chip8 *chip, void *buff, size_t size);
+// Restores a chip8_SaveState blob, returns false when it is not one. Keeps the
+// keyboard map and host, empties the decode cache and redraws the screen.
+bool chip8_LoadState ( chip8 *chip, const void *buff, size_t size);
 void chip8_ExecuteInstruction ( chip8 *chip, unsigned short opcode);
-void chip8_ExecuteInstructionExtended(chip8 *chip, unsigned short opcode);
-void chip8_ExecuteInstructionClassEight( chip8 *chip, unsigned short opcode);
-void chip8_ExecuteInstructionClassF_instruction( chip8 *chip, unsigned short opcode);
\ No newline at end of file
+// Runs the instruction at PC through the decode cache
+void chip8_Step ( chip8 *chip);
+// True for ops that end a straight-line block
+bool chip8_IsBlockEnd( unsigned char op);
+// Returns the first decoded slot of the block at an even pc, building it if needed
+const chip8Instruction * chip8_GetBlock ( chip8Mem *memory, int pc);
+// Runs at most max instructions of the cached block at PC, returns the count run
+int  chip8_ExecuteBlock ( chip8 *chip, int max);
+// Runs exactly cycles instructions through the block cache, less when
+// Fx0A starts waiting for a key. Returns the count run.
+int  chip8_Run ( chip8 *chip, int cycles);
+// Same as chip8_Run on the computed-goto threaded interpreter
+int  chip8_RunThreaded ( chip8 *chip, int cycles);
+
+//------------------------------------------------------------------------------------------
+// CHIP8 INSTRUCTION DISPATCH
+//------------------------------------------------------------------------------------------
+// One id per instruction handler. Every 16-bit opcode maps to exactly one id.
+typedef enum chip8_Op {
+    CHIP8_OP_DECODE,     // empty decode cache slot
+    CHIP8_OP_NOP,        // unknown opcodes and 0nnn SYS
+    CHIP8_OP_CLS,        // 00E0
+    CHIP8_OP_RET,        // 00EE
+    CHIP8_OP_JP,         // 1nnn
+    CHIP8_OP_CALL,       // 2nnn
+    CHIP8_OP_SE_VX_KK,   // 3xkk
+    CHIP8_OP_SNE_VX_KK,  // 4xkk
+    CHIP8_OP_SE_VX_VY,   // 5xy0
+    CHIP8_OP_LD_VX_KK,   // 6xkk
+    CHIP8_OP_ADD_VX_KK,  // 7xkk
+    CHIP8_OP_LD_VX_VY,   // 8xy0
+    CHIP8_OP_OR,         // 8xy1
+    CHIP8_OP_AND,        // 8xy2
+    CHIP8_OP_XOR,        // 8xy3
+    CHIP8_OP_ADD_VX_VY,  // 8xy4
+    CHIP8_OP_SUB,        // 8xy5
+    CHIP8_OP_SHR,        // 8xy6
+    CHIP8_OP_SUBN,       // 8xy7
+    CHIP8_OP_SHL,        // 8xyE
+    CHIP8_OP_SNE_VX_VY,  // 9xy0
+    CHIP8_OP_LD_I,       // Annn
+    CHIP8_OP_JP_V0,      // Bnnn
+    CHIP8_OP_RND,        // Cxkk
+    CHIP8_OP_DRW,        // Dxyn
+    CHIP8_OP_SKP,        // Ex9E
+    CHIP8_OP_SKNP,       // ExA1
+    CHIP8_OP_LD_VX_DT,   // Fx07
+    CHIP8_OP_LD_VX_K,    // Fx0A
+    CHIP8_OP_LD_DT_VX,   // Fx15
+    CHIP8_OP_LD_ST_VX,   // Fx18
+    CHIP8_OP_ADD_I_VX,   // Fx1E
+    CHIP8_OP_LD_F_VX,    // Fx29
+    CHIP8_OP_LD_B_VX,    // Fx33
+    CHIP8_OP_LD_I_VX,    // Fx55
+    CHIP8_OP_LD_VX_I,    // Fx65
+    // Fused pairs, only produced by the block cache
+    CHIP8_OP_LD_VX_KK_LD_I,  // 6xkk Annn
+    CHIP8_OP_SE_VX_KK_JP,    // 3xkk 1nnn
+    CHIP8_OP_SNE_VX_KK_JP,   // 4xkk 1nnn
+    CHIP8_OP_ADD_VX_KK_SE,   // 7xkk 3xkk
+    CHIP8_OP_ADD_VX_KK_SNE,  // 7xkk 4xkk
+    CHIP8_OP_COUNT,
+    CHIP8_OP_FUSED = CHIP8_OP_LD_VX_KK_LD_I
+} chip8_Op;
+
+typedef void (*chip8_OpHandler) ( chip8 *chip, const chip8Instruction *ins);
+
+// Builds the opcode -> handler table, called by chip8_init
+void chip8_InitDispatch( void );
+// Returns the chip8_Op id of an opcode
+unsigned char chip8_GetOp( unsigned short opcode);
+// Returns the opcode pattern and mnemonic of an op id, e.g. "8xy4 ADD"
+const char * chip8_GetOpName( unsigned char op);
+// Returns the handler the interpreter runs for an op id
+chip8_OpHandler chip8_GetHandler( unsigned char op);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,11 @@
+#include "chip8.h"
+
+//------------------------------------------------------------------------------------------
+// CHIP8 AOT
+//------------------------------------------------------------------------------------------
+// Entry point of a ROM translated to C by chip8aot (make aot ROM=...).
+// Runs exactly cycles instructions, less when Fx0A starts waiting for a key,
+// and returns the count run. Addresses the
+// translation does not cover, code the ROM has rewritten and blocks that do not
+// fit the remaining cycles go through chip8_Step.
+int chip8_AotRun ( chip8 *chip, int cycles);
\ No newline at end of file
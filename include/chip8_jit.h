@@ -0,0 +1,17 @@
+#include "chip8.h"
+
+//------------------------------------------------------------------------------------------
+// CHIP8 JIT
+//------------------------------------------------------------------------------------------
+// Optional x86-64 recompiler for hot blocks of the block cache. Blocks that are
+// not hot yet, or cannot fit the remaining cycle budget, run on the interpreter.
+typedef struct chip8Jit chip8Jit;
+
+// Returns NULL when the host is not x86-64 or executable memory is unavailable
+chip8Jit * chip8_JitCreate ( void );
+void chip8_JitDestroy ( chip8Jit *jit);
+// Drops every translated block
+void chip8_JitFlush ( chip8Jit *jit);
+// Runs exactly cycles instructions of chip, less when Fx0A starts waiting for
+// a key, returns the count run. A NULL jit runs everything on chip8_Run.
+int  chip8_JitRun ( chip8Jit *jit, chip8 *chip, int cycles);
\ No newline at end of file
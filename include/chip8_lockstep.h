@@ -0,0 +1,29 @@
+#include "chip8.h"
+
+//------------------------------------------------------------------------------------------
+// CHIP8 LOCKSTEP
+//------------------------------------------------------------------------------------------
+// Runs many instances of one program side by side. V registers, I, PC and the
+// timers of all instances are kept as structure-of-arrays; instances at the same
+// PC run register-only instructions together on AVX2 lanes, everything else
+// runs per instance on chip8_Step. Without AVX2 on the host CPU every
+// instruction takes the chip8_Step path. Memory, stack, keyboard and screen
+// stay in one chip8 per instance.
+typedef struct chip8Lockstep chip8Lockstep;
+
+// Creates count instances with the program loaded, NULL when out of memory
+chip8Lockstep * chip8_LockstepCreate ( int count, const char *buff, size_t size);
+void chip8_LockstepDestroy ( chip8Lockstep *ls);
+// Runs cycles instructions on every instance. An instance waiting on Fx0A keeps
+// running Fx0A until a key goes down.
+void chip8_LockstepRun ( chip8Lockstep *ls, int cycles);
+// chip8_TickTimers for every instance, without host sound callbacks
+void chip8_LockstepTickTimers ( chip8Lockstep *ls);
+// Copies the registers of instance i into its chip8 and returns it. Use it to
+// read state or put keys down; registers and memory written through it are
+// not seen by the engine.
+chip8 * chip8_LockstepGetChip ( chip8Lockstep *ls, int i);
+// Turns the AVX2 path off, or back on when the CPU supports it, and returns
+// whether it is on. Both paths give the same results, src/chip8_check.c
+// compares them with chip8_Run.
+bool chip8_LockstepSetSimd ( chip8Lockstep *ls, bool enable);
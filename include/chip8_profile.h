@@ -0,0 +1,28 @@
+#include "chip8.h"
+#include <stdio.h>
+
+//------------------------------------------------------------------------------------------
+// CHIP8 PROFILER
+//------------------------------------------------------------------------------------------
+// Build with -DCHIP8_PROFILE to count every instruction the interpreter
+// cores run per op, per opcode and per address, and to print the counts
+// sorted to stderr at exit. Without it the hooks compile to nothing. The
+// counters are plain globals, profile one instance on one thread. Code run
+// by the JIT or the AOT translation is not counted.
+
+#ifdef CHIP8_PROFILE
+
+// Registers the exit report, called by chip8_init
+void chip8_ProfileInit ( void );
+void chip8_ProfileCount ( int pc, unsigned short opcode);
+void chip8_ProfileReport ( FILE *out);
+
+#define CHIP8_PROFILE_INIT()            chip8_ProfileInit()
+#define CHIP8_PROFILE_COUNT(pc, opcode) chip8_ProfileCount((pc), (opcode))
+
+#else
+
+#define CHIP8_PROFILE_INIT()            ((void) 0)
+#define CHIP8_PROFILE_COUNT(pc, opcode) ((void) 0)
+
+#endif
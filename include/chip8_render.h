@@ -0,0 +1,33 @@
+#include "chip8.h"
+#include "SDL2/SDL.h"
+
+//------------------------------------------------------------------------------------------
+// CHIP8 RENDERER
+//------------------------------------------------------------------------------------------
+// Presents the framebuffer through a WIN_WIDTH x WIN_HEIGHT streaming texture
+// that SDL scales up to the window.
+typedef struct chip8Renderer chip8Renderer;
+
+// Returns NULL and prints the SDL error when the renderer or texture fails
+chip8Renderer * chip8_RendererCreate ( SDL_Window *window);
+void chip8_RendererDestroy ( chip8Renderer *r);
+// Uploads the rows set in dirty_rows into the texture and presents it
+void chip8_RendererPresent ( chip8Renderer *r, const chip8Screen *screen, uint32_t dirty_rows);
+
+//------------------------------------------------------------------------------------------
+// CHIP8 FRAME QUEUE
+//------------------------------------------------------------------------------------------
+// Hands frames from the emulation thread to the thread that owns the window
+// and renderer, which SDL requires to be the main thread. A lock-free triple
+// buffer: the emulation thread never waits on SDL_RenderPresent or vsync and
+// the main thread always takes the newest frame.
+typedef struct chip8FrameQueue chip8FrameQueue;
+
+chip8FrameQueue * chip8_FrameQueueCreate ( void );
+void chip8_FrameQueueDestroy ( chip8FrameQueue *q);
+// Emulation thread: copies screen into a free buffer and hands it over, never blocks
+void chip8_FrameQueuePublish ( chip8FrameQueue *q, const chip8Screen *screen);
+// Main thread: the newest frame published since the last take, NULL if none.
+// Frames may be skipped, so dirty_rows gets the rows that differ from the
+// previous frame taken (all of them for the first).
+const chip8Screen * chip8_FrameQueueTake ( chip8FrameQueue *q, uint32_t *dirty_rows);
@@ -0,0 +1,21 @@
+#include "chip8.h"
+
+//------------------------------------------------------------------------------------------
+// CHIP8 REWIND
+//------------------------------------------------------------------------------------------
+// Keeps the last frames of a run as savestates in a fixed-size ring. Every
+// CHIP8_REWIND_KEYFRAME_INTERVAL frames a keyframe is stored, the frames in
+// between are stored as the XOR of their state against that keyframe, run
+// length encoded. When the ring is full the oldest keyframe goes, together
+// with its frames.
+typedef struct chip8Rewind chip8Rewind;
+
+// Ring of bytes of encoded states and at most frames frames, NULL when out of memory
+chip8Rewind * chip8_RewindCreate ( size_t bytes, int frames);
+void chip8_RewindDestroy ( chip8Rewind *rw);
+// Captures the state of chip, called once per frame
+void chip8_RewindCapture ( chip8Rewind *rw, const chip8 *chip);
+// Loads the newest capture into chip and drops it, false when none is left
+bool chip8_RewindStep ( chip8Rewind *rw, chip8 *chip);
+// Frames that can be stepped back
+int  chip8_RewindFrames ( const chip8Rewind *rw);
@@ -0,0 +1,54 @@
+#include "chip8.h"
+
+//------------------------------------------------------------------------------------------
+// CHIP8 TRACE
+//------------------------------------------------------------------------------------------
+// Build with -DCHIP8_TRACE to let chip8_TraceStart record every instruction
+// an instance runs to a binary file. Records go through a ring to a writer
+// thread, the emulator only blocks when the writer falls a whole ring
+// behind. While tracing every core runs one instruction at a time through
+// chip8_Step. Without the flag a chip8 never traces and nothing is built.
+//
+// The file is a chip8TraceHeader followed by chip8TraceRecord, both in the
+// byte order of the host that wrote them. bin/chip8trace prints and filters
+// them.
+
+#define CHIP8_TRACE_MAGIC   "C8TR"
+#define CHIP8_TRACE_VERSION 1
+
+typedef struct chip8TraceHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+} chip8TraceHeader;
+
+typedef struct chip8TraceRecord {
+    uint64_t cycle;             // instructions the instance ran before this one
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;                 // I after the instruction
+    uint8_t  reg;               // lowest V register it changed, 0xff for none
+    uint8_t  value;             // new value of reg
+} chip8TraceRecord;
+
+#ifdef CHIP8_TRACE
+
+// State before an instruction, compared against after it
+typedef struct chip8TraceMark {
+    uint16_t pc;
+    uint16_t opcode;
+    unsigned char V[16];
+} chip8TraceMark;
+
+// Starts recording chip to path, NULL when the file or the writer thread
+// cannot be created. One trace per instance, stop it before starting another.
+chip8Trace * chip8_TraceStart ( chip8 *chip, const char *path);
+// Flushes the remaining records and closes the file
+void chip8_TraceStop ( chip8 *chip);
+
+// Hooks around one instruction, called by chip8_Step
+void chip8_TraceBefore ( chip8 *chip, chip8TraceMark *mark);
+void chip8_TraceAfter ( chip8 *chip, const chip8TraceMark *mark);
+
+#endif
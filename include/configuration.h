@@ -4,6 +4,9 @@
 #define WIN_WIDTH 64 
 #define WIN_MULTIPLIER 10
 
+// RAM page size, pages are shared between forked instances until written
+#define CHIP8_PAGE_SIZE 256
+
 // V register coutn
 #define V_REGISTER_COUNT 16
 
@@ -20,4 +23,48 @@
 #define CHIP8_PROGRAM_LOAD_ADDR 0x200
 
 // Sprite height
-#define CHIP8_DEFAULT_SPRITE_HEIGHT 5
\ No newline at end of file
+#define CHIP8_DEFAULT_SPRITE_HEIGHT 5
+
+// Most rows one Dxyn draws
+#define CHIP8_SPRITE_MAX_ROWS 16
+
+// Seed chip8_init gives the RND generator, set another with chip8_Seed
+#define CHIP8_DEFAULT_SEED 0x8badf00d
+
+// Frames per second of the main loop, timers tick once per frame
+#define CHIP8_FRAME_RATE 60
+
+// Instructions run per frame, override with -ipf
+#define CHIP8_INSTRUCTIONS_PER_FRAME 10
+
+// Frames between rewind keyframes, the others are deltas against one
+#define CHIP8_REWIND_KEYFRAME_INTERVAL 60
+
+// Square wave played while the sound timer runs: pitch, output rate and volume
+#define CHIP8_BEEP_FREQUENCY   440
+#define CHIP8_BEEP_SAMPLE_RATE 44100
+#define CHIP8_BEEP_VOLUME      3000
+
+// Rewind ring of the game: bytes of encoded states and most frames kept
+#define CHIP8_REWIND_BYTES  (512 * 1024)
+#define CHIP8_REWIND_FRAMES (CHIP8_FRAME_RATE * 60 * 3)
+
+// Trace records buffered between the emulator and the writer thread, and
+// how many pile up before the writer wakes to flush them
+#define CHIP8_TRACE_RING_RECORDS  (1 << 16)
+#define CHIP8_TRACE_FLUSH_RECORDS (1 << 12)
+
+// Longest line of a chip8batch session list
+#define CHIP8_BATCH_LINE_MAX 65536
+
+// Most worker threads chip8batch starts
+#define CHIP8_BATCH_MAX_THREADS 256
+
+// Longest straight-line block kept by the block cache (max 255)
+#define CHIP8_BLOCK_MAX_LEN 32
+
+// Executions of a block before the JIT translates it
+#define CHIP8_JIT_HOT_THRESHOLD 16
+
+// Size of the JIT executable code buffer
+#define CHIP8_JIT_CODE_SIZE (1024 * 1024)
@@ -1,9 +1,9 @@
 #include "../include/chip8.h"
+#include "../include/chip8_profile.h"
+#include "../include/chip8_trace.h"
 #include "assert.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include "../include/SDL2/SDL.h"
-#include <time.h>
 
 //-----------------------------------------------------------------
 // CHIP8 MEMORY FUNCTIONS
@@ -13,16 +13,99 @@ void chip8_CheckMemIndexBound(int index) {
     assert( index >= 0 && index < CHIP8_MEM_SIZE );
 }
 
+static void chip8_PageRelease ( chip8Page *page) {
+    if (page->refs != 0 && __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(page);
+}
+
+// Returns the byte at index in a page only this memory holds, copying the page if shared
+static unsigned char * chip8_PageWritable ( chip8Mem *memory, int index) {
+    chip8Page **page = &memory->pages[index / CHIP8_PAGE_SIZE];
+    if (__atomic_load_n(&(*page)->refs, __ATOMIC_ACQUIRE) != 1) {
+        chip8Page *copy = malloc(sizeof(chip8Page));
+        assert( copy);
+        copy->refs = 1;
+        memcpy(copy->bytes, (*page)->bytes, CHIP8_PAGE_SIZE);
+        chip8_PageRelease(*page);
+        *page = copy;
+    }
+    return &(*page)->bytes[index % CHIP8_PAGE_SIZE];
+}
+
+// Copies size bytes into RAM at index without touching the decode cache
+static void chip8_WriteMem ( chip8Mem *memory, int index, const unsigned char *src, size_t size) {
+    assert( index >= 0 && index + size <= CHIP8_MEM_SIZE);
+    while (size > 0) {
+        size_t n = CHIP8_PAGE_SIZE - index % CHIP8_PAGE_SIZE;
+        if (n > size)
+            n = size;
+        const unsigned char *old = &memory->pages[index / CHIP8_PAGE_SIZE]->bytes[index % CHIP8_PAGE_SIZE];
+        // equal bytes leave a shared page shared
+        if (memcmp(old, src, n) != 0)
+            memcpy(chip8_PageWritable(memory, index), src, n);
+        index += n;
+        src   += n;
+        size  -= n;
+    }
+}
+
 unsigned char chip8_GetMem (chip8Mem *memory, int index) {
-    // fetches the value at index passed in chip8Mem->RAM
+    // fetches the value at index passed in chip8Mem->pages
     chip8_CheckMemIndexBound(index);
-    return memory->RAM[index];
+    return memory->pages[index / CHIP8_PAGE_SIZE]->bytes[index % CHIP8_PAGE_SIZE];
 
 }
 void chip8_SetMem (chip8Mem *memory, int index, unsigned char val) {
-    // sets the value at index passed in chip8Mem->RAM
+    // sets the value at index passed in chip8Mem->pages
+    chip8_CheckMemIndexBound(index);
+    *chip8_PageWritable(memory, index) = val;
+    chip8_InvalidateMem(memory, index);
+}
+
+const unsigned char * chip8_GetMemSpan (chip8Mem *memory, int index, int len, unsigned char *scratch) {
     chip8_CheckMemIndexBound(index);
-    memory->RAM[index] = val;
+    if (index % CHIP8_PAGE_SIZE + len <= CHIP8_PAGE_SIZE)
+        return &memory->pages[index / CHIP8_PAGE_SIZE]->bytes[index % CHIP8_PAGE_SIZE];
+    for (int i = 0; i < len; i++) {
+        scratch[i] = chip8_GetMem(memory, (index + i) % CHIP8_MEM_SIZE);
+    }
+    return scratch;
+}
+
+void chip8_InvalidateMem (chip8Mem *memory, int index) {
+    // drops the cached decode of the instruction covering index and
+    // every cached block that runs over it
+    if (!memory->decoded)
+        return;
+    int slot  = index >> 1;
+    int first = slot - CHIP8_BLOCK_MAX_LEN + 1;
+    if (memory->decoded[slot].op != CHIP8_OP_DECODE)
+        memory->code_generation++;
+    memory->decoded[slot].op = CHIP8_OP_DECODE;
+    memory->decoded[slot].block_op = CHIP8_OP_DECODE;
+    // the previous slot may be fused with this one
+    if (slot > 0)
+        memory->decoded[slot - 1].block_op = memory->decoded[slot - 1].op;
+    for (int start = first < 0 ? 0 : first; start <= slot; start++) {
+        if (start + memory->decoded[start].block_len > slot)
+            memory->decoded[start].block_len = 0;
+    }
+}
+
+chip8Instruction * chip8_GetDecoded (chip8Mem *memory) {
+    if (!memory->decoded) {
+        // all zero is CHIP8_OP_DECODE in every slot
+        memory->decoded = calloc(CHIP8_MEM_SIZE / 2, sizeof(chip8Instruction));
+        assert( memory->decoded);
+    }
+    return memory->decoded;
+}
+
+// Empties the decode cache after RAM was replaced behind chip8_SetMem's back
+static void chip8_ResetDecoded (chip8Mem *memory) {
+    if (memory->decoded)
+        memset(memory->decoded, 0, CHIP8_MEM_SIZE / 2 * sizeof(chip8Instruction));
+    memory->code_generation++;
 }
 
 unsigned short chip8_FetchInstructionMem (chip8Mem *memory, int index) {
@@ -58,20 +141,6 @@ unsigned short chip8_StackPop ( chip8 *chip8) {
 //------------------------------------------------------------------
 // CHIP8 KEYBOARD FUNCTIONS
 //------------------------------------------------------------------
-char chip8_waitForKeyPress (chip8 *chip) {
-    SDL_Event event;
-    while ( SDL_WaitEvent(&event)) {
-
-        if (event.type != SDL_KEYDOWN ) 
-            continue;
-        char pressedkey = event.key.keysym.sym;
-        char chip8_key = chip8_MapKey( &chip->keyboard, pressedkey );
-        if (chip8_key != -1 )
-            return chip8_key;
-    }
-    return -1;
-}
-
 void chip8_KeyboardSetKeyboardMap ( chip8Keyboard *keyboard, const char *map) {
     keyboard->map = map;
 }
@@ -87,6 +156,12 @@ int  chip8_MapKey    ( chip8Keyboard *keyboard, char key) {
 
 void chip8_PutKeyDown( chip8Keyboard *keyboard, int key) {
     keyboard->v_keyboard[key] = true;
+    // ends a pending Fx0A wait
+    if (keyboard->waiting) {
+        keyboard->waiting  = false;
+        keyboard->wait_done = true;
+        keyboard->wait_key = key;
+    }
 }
 
 void chip8_PutKeyUp  ( chip8Keyboard *keyboard, int key) {
@@ -104,39 +179,81 @@ void chip8_ScreenCheckBound ( int x, int y) {
 }
 void chip8_SetScreenPixle( chip8Screen *screen, int x, int y) {
     chip8_ScreenCheckBound( x, y);
-    screen->pixle[y][x] = true;
+    screen->rows[y] |= (uint64_t) 1 << (WIN_WIDTH - 1 - x);
+    screen->dirty_rows |= (uint32_t) 1 << y;
+    screen->generation++;
 }
 bool chip8_IsScreenPixleSet ( chip8Screen *screen, int x, int y) {
     chip8_ScreenCheckBound( x, y);
-    return screen->pixle[y][x];
+    return (screen->rows[y] >> (WIN_WIDTH - 1 - x)) & 1;
+}
+uint64_t chip8_GetScreenRow ( const chip8Screen *screen, int y) {
+    chip8_ScreenCheckBound( 0, y);
+    return screen->rows[y];
 }
 
-bool chip8_ScreenDrawSprite ( chip8Screen *screen, int x, int y, const char *sprites, int num) {
+// Blitter picked for the host CPU by chip8_init, or on first draw. Threads
+// that race here store the same pointer, atomically.
+static chip8_SpriteBlitter chip8_blit;
+
+static chip8_SpriteBlitter chip8_InitScreen( void ) {
+    chip8_SpriteBlitter blit = __atomic_load_n(&chip8_blit, __ATOMIC_ACQUIRE);
+    if (!blit) {
+        blit = chip8_GetSpriteBlitter();
+        __atomic_store_n(&chip8_blit, blit, __ATOMIC_RELEASE);
+    }
+    return blit;
+}
 
-    bool pixle_collision = false;
-    for (int ly = 0; ly < num; ly++){
-        char sprite = sprites[ly];
-        for (int lx = 0; lx < 8; lx++) {
-            if ((sprite & (0b10000000 >> lx)) == 0 )
-                continue;
+bool chip8_ScreenDrawSprite ( chip8Screen *screen, int x, int y, const char *sprites, int num) {
+    assert( num >= 0 && num <= CHIP8_SPRITE_MAX_ROWS);
+    chip8_SpriteBlitter blit = chip8_InitScreen();
 
-            if (screen->pixle[(ly + y)%WIN_HEIGHT][(lx + x)%WIN_WIDTH])
-                pixle_collision = true;
-            screen->pixle[(ly + y)%WIN_HEIGHT][(lx + x)%WIN_WIDTH]^= true;
+    // Sprite rows start in the top byte and rotate right to x, which
+    // wraps pixels past the right edge like (lx + x) % WIN_WIDTH did.
+    // Rows past the bottom edge wrap to the top as a second run.
+    const unsigned char *sprite = (const unsigned char *) sprites;
+    int shift = x % WIN_WIDTH;
+    int top   = y % WIN_HEIGHT;
+    int first = num < WIN_HEIGHT - top ? num : WIN_HEIGHT - top;
+    bool collision = blit(&screen->rows[top], sprite, first, shift);
+    if (first < num)
+        collision |= blit(&screen->rows[0], sprite + first, num - first, shift);
 
-        }
+    if (num > 0) {
+        // num rows from top, wrapping past the bottom edge
+        uint64_t span = (((uint64_t) 1 << num) - 1) << top;
+        screen->dirty_rows |= (uint32_t) (span | (span >> WIN_HEIGHT));
+        screen->generation++;
     }
-    return pixle_collision;
+    return collision;
 }
 
 void chip8_ScreenClear( chip8Screen *screen) {
-    memset (screen->pixle, 0 , sizeof(screen->pixle));
+    memset (screen->rows, 0 , sizeof(screen->rows));
+    screen->dirty_rows = (uint32_t) (((uint64_t) 1 << WIN_HEIGHT) - 1);
+    screen->generation++;
+}
+
+uint32_t chip8_ScreenTakeDirtyRows ( chip8Screen *screen) {
+    uint32_t rows = screen->dirty_rows;
+    screen->dirty_rows = 0;
+    return rows;
 }
 //-------------------------------------------------------------------
 // CHIP8 FUNCTIONS
 //-------------------------------------------------------------------
 //  CHIP8 DEFAULT CHAR SET
-const char chip8_default_character_set[] = {
+#define CHIP8_FONT_OFFSET (CHIP8_CHARACTERSET_LOAD_ADDR % CHIP8_PAGE_SIZE)
+#if CHIP8_FONT_OFFSET + 80 > CHIP8_PAGE_SIZE
+#error "the character set must fit in one page"
+#endif
+
+// chip8_init points every page at one of these, so a fresh chip owns no
+// memory until it writes. Both are filled at compile time and never
+// written, so threads can share them without setup.
+static chip8Page chip8_zero_page;
+static chip8Page chip8_font_page = { 0, { [CHIP8_FONT_OFFSET] =
     0xf0, 0x90, 0x90, 0x90, 0xf0,
     0x20, 0x60, 0x20, 0x20, 0x70,
     0xf0, 0x10, 0xf0, 0x80, 0xf0,
@@ -153,12 +270,52 @@ const char chip8_default_character_set[] = {
     0xe0, 0x90, 0x90, 0x90, 0xe0,
     0xf0, 0x80, 0xf0, 0x80, 0xf0, 
     0xf0, 0x80, 0xf0, 0x80, 0x80
-};
+} };
+
+static void chip8_InitPages ( chip8Mem *memory) {
+    for (int i = 0; i < CHIP8_PAGE_COUNT; i++) {
+        memory->pages[i] = &chip8_zero_page;
+    }
+    memory->pages[CHIP8_CHARACTERSET_LOAD_ADDR / CHIP8_PAGE_SIZE] = &chip8_font_page;
+}
 
 // CHIP8 INIT
 void chip8_init( chip8 *chip) {
+    chip8_InitDispatch();
+    chip8_InitScreen();
+    CHIP8_PROFILE_INIT();
     memset(chip, 0 , sizeof(chip8));
-    memcpy(&chip->memory.RAM, chip8_default_character_set, sizeof(chip8_default_character_set));
+    chip8_InitPages(&chip->memory);
+    chip8_Seed(chip, CHIP8_DEFAULT_SEED);
+}
+
+void chip8_Fork ( chip8 *dst, const chip8 *src) {
+    // the decode cache is rebuilt by the first run rather than copied
+    memcpy(dst, src, sizeof(chip8));
+    dst->trace = NULL;
+    dst->memory.decoded = NULL;
+    for (int i = 0; i < CHIP8_PAGE_COUNT; i++) {
+        if (dst->memory.pages[i]->refs != 0)
+            __atomic_add_fetch(&dst->memory.pages[i]->refs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void chip8_Release ( chip8 *chip) {
+    for (int i = 0; i < CHIP8_PAGE_COUNT; i++) {
+        chip8_PageRelease(chip->memory.pages[i]);
+        chip->memory.pages[i] = &chip8_zero_page;
+    }
+    free(chip->memory.decoded);
+    chip->memory.decoded = NULL;
+}
+
+void chip8_Seed ( chip8 *chip, uint64_t seed) {
+    // splitmix64 spreads nearby seeds apart; xorshift sticks at zero
+    uint64_t z = seed + 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    z ^= z >> 31;
+    chip->rng = z ? z : 1;
 }
 
 const char * chip8_ReadProgram( char *filename, long *filesize ) {
@@ -184,263 +341,819 @@ const char * chip8_ReadProgram( char *filename, long *filesize ) {
     return buff;
 }
 
+void chip8_SetHost ( chip8 *chip, const chip8Host *host) {
+    chip->host = host;
+}
+
+void chip8_ScreenChanged ( chip8 *chip) {
+    if (chip->host && chip->host->draw)
+        chip->host->draw(chip->host->user, &chip->screen);
+}
+
+void chip8_TickTimers ( chip8 *chip) {
+    if (chip->registers.delay_timer > 0)
+        chip->registers.delay_timer -= 1;
+    if (chip->registers.sound_timer > 0)
+        chip->registers.sound_timer -= 1;
+
+    // Fx18 only sets the timer, the host hears about it on the next tick
+    bool on = chip->registers.sound_timer > 0;
+    if (on != chip->sound_on) {
+        chip->sound_on = on;
+        if (chip->host && chip->host->sound)
+            chip->host->sound(chip->host->user, on);
+    }
+}
+
+//-------------------------------------------------------------------
+// CHIP8 SAVESTATE
+//-------------------------------------------------------------------
+// Fields are written back to back, multi-byte values little-endian, so a
+// blob loads on any host. Bump the version when the layout changes.
+#define CHIP8_STATE_MAGIC   "C8ST"
+#define CHIP8_STATE_VERSION 1
+
+static unsigned char * chip8_StatePut ( unsigned char *p, uint64_t val, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        *p++ = val >> (8 * i);
+    }
+    return p;
+}
+
+static const unsigned char * chip8_StateGet ( const unsigned char *p, uint64_t *val, int bytes) {
+    *val = 0;
+    for (int i = 0; i < bytes; i++) {
+        *val |= (uint64_t) *p++ << (8 * i);
+    }
+    return p;
+}
+
+size_t chip8_SaveState ( const chip8 *chip, void *buff, size_t size) {
+    if (size < CHIP8_STATE_SIZE)
+        return 0;
+    unsigned char *p = buff;
+    const chip8Registers *r = &chip->registers;
+    const chip8Keyboard *k = &chip->keyboard;
+
+    memcpy(p, CHIP8_STATE_MAGIC, 4);
+    p = chip8_StatePut(p + 4, CHIP8_STATE_VERSION, 4);
+    for (int i = 0; i < CHIP8_PAGE_COUNT; i++) {
+        memcpy(p, chip->memory.pages[i]->bytes, CHIP8_PAGE_SIZE);
+        p += CHIP8_PAGE_SIZE;
+    }
+    memcpy(p, r->V_Registers, V_REGISTER_COUNT);
+    p += V_REGISTER_COUNT;
+    *p++ = r->delay_timer;
+    *p++ = r->sound_timer;
+    *p++ = r->stackPointer;
+    p = chip8_StatePut(p, r->I_Register, 2);
+    p = chip8_StatePut(p, r->PC, 2);
+    for (int i = 0; i < CHIP8_STACK_SIZE; i++) {
+        p = chip8_StatePut(p, chip->stack.stack[i], 2);
+    }
+    for (int i = 0; i < CHIP8_KEYBOARD_SIZE; i++) {
+        *p++ = k->v_keyboard[i];
+    }
+    *p++ = k->waiting;
+    *p++ = k->wait_done;
+    *p++ = k->wait_key;
+    for (int y = 0; y < WIN_HEIGHT; y++) {
+        p = chip8_StatePut(p, chip->screen.rows[y], 8);
+    }
+    p = chip8_StatePut(p, chip->rng, 8);
+
+    assert( p == (unsigned char *) buff + CHIP8_STATE_SIZE);
+    return CHIP8_STATE_SIZE;
+}
+
+bool chip8_LoadState ( chip8 *chip, const void *buff, size_t size) {
+    const unsigned char *p = buff;
+    uint64_t val;
+    if (size < CHIP8_STATE_SIZE || memcmp(p, CHIP8_STATE_MAGIC, 4) != 0)
+        return false;
+    p = chip8_StateGet(p + 4, &val, 4);
+    if (val != CHIP8_STATE_VERSION)
+        return false;
+    chip8Registers *r = &chip->registers;
+    chip8Keyboard *k = &chip->keyboard;
+
+    // Cached decodes and JIT code describe the old RAM
+    chip8_WriteMem(&chip->memory, 0, p, CHIP8_MEM_SIZE);
+    p += CHIP8_MEM_SIZE;
+    chip8_ResetDecoded(&chip->memory);
+
+    memcpy(r->V_Registers, p, V_REGISTER_COUNT);
+    p += V_REGISTER_COUNT;
+    r->delay_timer  = *p++;
+    r->sound_timer  = *p++;
+    r->stackPointer = *p++;
+    p = chip8_StateGet(p, &val, 2);
+    r->I_Register = val;
+    p = chip8_StateGet(p, &val, 2);
+    r->PC = val;
+    for (int i = 0; i < CHIP8_STACK_SIZE; i++) {
+        p = chip8_StateGet(p, &val, 2);
+        chip->stack.stack[i] = val;
+    }
+    for (int i = 0; i < CHIP8_KEYBOARD_SIZE; i++) {
+        k->v_keyboard[i] = *p++;
+    }
+    k->waiting   = *p++;
+    k->wait_done = *p++;
+    k->wait_key  = *p++;
+    for (int y = 0; y < WIN_HEIGHT; y++) {
+        p = chip8_StateGet(p, &chip->screen.rows[y], 8);
+    }
+    p = chip8_StateGet(p, &chip->rng, 8);
+
+    // sound_on stays as the host last heard it, the next tick reports a change
+    chip->screen.generation++;
+    chip->screen.dirty_rows = (uint32_t) (((uint64_t) 1 << WIN_HEIGHT) - 1);
+    chip8_ScreenChanged(chip);
+    return true;
+}
+
 void chip8_LoadProgram ( chip8 *chip, const char *buff, size_t size) {
     assert( CHIP8_PROGRAM_LOAD_ADDR + size < CHIP8_MEM_SIZE);
-    memcpy( &chip->memory.RAM[CHIP8_PROGRAM_LOAD_ADDR], buff, size);
+    chip8_WriteMem( &chip->memory, CHIP8_PROGRAM_LOAD_ADDR, (const unsigned char *) buff, size);
+    chip8_ResetDecoded(&chip->memory);
     chip->registers.PC = CHIP8_PROGRAM_LOAD_ADDR;
 }
 
-// Function for OPCODE starting from 8: eg - 8xy1, 8xy2
-void chip8_ExecuteInstructionClassEight( chip8 *chip, unsigned short opcode){
-    unsigned short nnn = opcode & 0x0fff;
-    char x = (opcode >> 8) & 0x000f;
-    char y = (opcode >> 4) & 0x000f;
-    char kk = opcode & 0x00ff;
-    char last_four_bits = opcode & 0x000f;
-    unsigned short temp = 0;
+//-------------------------------------------------------------------
+// CHIP8 INSTRUCTION HANDLERS
+//-------------------------------------------------------------------
+// Unknown opcodes (and 0nnn SYS) are ignored
+static void chip8_OpNOP( chip8 *chip, const chip8Instruction *ins) {
+    (void) chip;
+    (void) ins;
+}
 
-    switch (last_four_bits) {
-        //8xy0 - LD Vx, Vy, Set Vx = Vy
-        case 0x00 :
-            chip->registers.V_Registers[x] = chip->registers.V_Registers[y];
-            break;
-        //8xy1 - OR Vx, Vy, Set Vx = Vx OR Vy
-        case 0x01 :
-            chip->registers.V_Registers[x] |= chip->registers.V_Registers[y];
-            break;
-        //8xy2 - AND Vx, Vy, Set Vx = Vx AND Vy
-        case 0x02 :
-            chip->registers.V_Registers[x] &= chip->registers.V_Registers[y];
-            break; 
-        //8xy3 - XOR Vx, Vy, Set Vx = Vx XOR Vy.
-        case 0x03 :
-            chip->registers.V_Registers[x] ^= chip->registers.V_Registers[y];
-            break;
-        //8xy4 - ADD Vx, Vy, Set Vx = Vx + Vy, set VF = carry.
-        case 0x04 :
-        {
-            temp = chip->registers.V_Registers[x] + chip->registers.V_Registers[y];
-            chip->registers.V_Registers[0x0f] = false;
-            if ( temp > 0xff ) {
-                chip->registers.V_Registers[0x0f] = true;
-            }
-            chip->registers.V_Registers[x] = temp;
-        }
-            break;
-        //8xy5 - SUB Vx, Vy, Set Vx = Vx - Vy, set VF = NOT borrow.
-        case 0x05 :
-        {
-            chip->registers.V_Registers[0x0f] = false;
-            if (  chip->registers.V_Registers[x] > chip->registers.V_Registers[y] ) {
-                chip->registers.V_Registers[0x0f] = true;
-            }
-            chip->registers.V_Registers[x] =  chip->registers.V_Registers[x] - chip->registers.V_Registers[y];
-        }
-            break;
-        //8xy6 - SHR Vx {, Vy}, Set Vx = Vx SHR 1.
-        case 0x06 : 
-        {
-            chip->registers.V_Registers[0x0f] = chip->registers.V_Registers[x] & 0x01 ;
-            chip->registers.V_Registers[x] /= 2;
-        }       
-            break;
-        //8xy7 - SUBN Vx, Vy, Set Vx = Vy - Vx, set VF = NOT borrow.
-        case 0x07 :
-        { 
-            chip->registers.V_Registers[0x0f] = chip->registers.V_Registers[y] > chip->registers.V_Registers[x];
-            chip->registers.V_Registers[x] =  chip->registers.V_Registers[y] - chip->registers.V_Registers[x];
-        }
-            break;
-        //8xyE - SHL Vx {, Vy}, Set Vx = Vx SHL 1.
-        case 0x0E :
-        { 
-            chip->registers.V_Registers[0x0f] = chip->registers.V_Registers[x] & 0b10000000 ;
-            chip->registers.V_Registers[x] *= 2;
-        }
-            break;
+//00E0 - CLS, clears screen
+static void chip8_OpCLS( chip8 *chip, const chip8Instruction *ins) {
+    (void) ins;
+    chip8_ScreenClear(&chip->screen);
+    chip8_ScreenChanged(chip);
+}
+
+//00EE - RET, returns from subroutine
+static void chip8_OpRET( chip8 *chip, const chip8Instruction *ins) {
+    (void) ins;
+    chip->registers.PC = chip8_StackPop(chip);
+}
 
+//1nnn - JP addr, jump to nnn addr
+static void chip8_OpJP( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.PC = ins->nnn;
+}
+
+//2nnn - CALL addr, call a subroutine
+static void chip8_OpCALL( chip8 *chip, const chip8Instruction *ins) {
+    chip8_StackPush(chip, chip->registers.PC);
+    chip->registers.PC = ins->nnn;
+}
 
+//3xkk - SE Vx, byte, Skip next instruction if Vx = kk
+static void chip8_OpSE_VxKK( chip8 *chip, const chip8Instruction *ins) {
+    if (chip->registers.V_Registers[ins->x] == ins->kk) {
+        chip->registers.PC += 2;
     }
 }
 
-// Execution function for opcode starting with F
-void chip8_ExecuteInstructionClassF_instruction( chip8 *chip, unsigned short opcode) {
-    unsigned short nnn = opcode & 0x0fff;
-    char x = (nnn >> 8) & 0x000f;
+//4xkk - SNE Vx, byte, Skip next instruction if Vx != kk
+static void chip8_OpSNE_VxKK( chip8 *chip, const chip8Instruction *ins) {
+    if (chip->registers.V_Registers[ins->x] != ins->kk) {
+        chip->registers.PC += 2;
+    }
+}
 
-    switch ( opcode & 0x00ff ) {
-        //Fx07 - LD Vx, DT, Set Vx = delay timer value
-        case 0x07 : 
-            chip->registers.V_Registers[x] = chip->registers.delay_timer;
-        break;
-        //Fx0A - LD Vx, K, Wait for a key press, store the value of the key in Vx.
-        case 0x0A :
-        {
-            char pressed_key               = chip8_waitForKeyPress(chip);
-            chip->registers.V_Registers[x] = pressed_key;
-            break;
-        }
-        //Fx15 - LD DT, Vx, Set delay timer = Vx.
-        case 0x15 :
-            chip->registers.delay_timer = chip->registers.V_Registers[x];
-            break;
-        //Fx18 - LD ST, Vx, Set sound timer = Vx
-        case 0x18 :
-            chip->registers.sound_timer = chip->registers.V_Registers[x];
-            break;
-        //Fx1E - ADD I, Vx,Set I = I + Vx.
-        case 0x1E :
-            chip->registers.I_Register += chip->registers.V_Registers[x];
-            break;
-        //Fx29 - LD F, Vx, Set I = location of sprite for digit Vx.
-        case 0x29 :
-            chip->registers.I_Register = chip->registers.V_Registers[x] * CHIP8_DEFAULT_SPRITE_HEIGHT;
-            break;
-        //Fx33 - LD B, Vx, Store BCD representation of Vx in memory locations I, I+1, and I+2.
-        case 0x33 :
-        {
-            unsigned char hundered = chip->registers.V_Registers[x] / 100;
-            unsigned char tenth    = chip->registers.V_Registers[x] / 10 % 10;
-            unsigned char ones     = chip->registers.V_Registers[x] % 10;
-            chip8_SetMem ( &chip->memory, chip->registers.I_Register, hundered);
-            chip8_SetMem ( &chip->memory, chip->registers.I_Register + 1, tenth);
-            chip8_SetMem ( &chip->memory, chip->registers.I_Register + 2, ones);
-        }
-            break;
-        //Fx55 - LD [I], Vx, Store registers V0 through Vx in memory starting at location I
-        case 0x55 :
-        {
-            for(int i=0; i<=x; i++){
-                chip8_SetMem( &chip->memory, chip->registers.I_Register +i, chip->registers.V_Registers[i]);
-            }
-        }
-            break;
-        //Fx65 - LD Vx, [I], Read registers V0 through Vx from memory starting at location I
-        case 0x65 :
-        {
-            for (int i =0; i<=x; i++) {
-                chip->registers.V_Registers[i] = chip8_GetMem( &chip->memory, chip->registers.I_Register + i);
-            }
-        }
-        break;
+//5xy0 - SE Vx, Vy, Skip next instruction if Vx = Vy.
+static void chip8_OpSE_VxVy( chip8 *chip, const chip8Instruction *ins) {
+    if (chip->registers.V_Registers[ins->x] == chip->registers.V_Registers[ins->y]) {
+        chip->registers.PC += 2;
     }
+}
 
+//6xkk - LD Vx, byte, Set Vx = kk.
+static void chip8_OpLD_VxKK( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins->x] = ins->kk;
 }
 
-void chip8_ExecuteInstructionExtended(chip8 *chip, unsigned short opcode) {
-    
-    unsigned short nnn = opcode & 0x0fff;
-    char x = (opcode >> 8) & 0x000f;
-    char y = (opcode >> 4) & 0x000f;
-    char kk = opcode & 0x00ff;
-    char n  = opcode & 0x000f;
+//7xkk - ADD Vx, byte, Set Vx = Vx + kk
+static void chip8_OpADD_VxKK( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins->x] += ins->kk;
+}
+
+//8xy0 - LD Vx, Vy, Set Vx = Vy
+static void chip8_OpLD_VxVy( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins->x] = chip->registers.V_Registers[ins->y];
+}
+
+//8xy1 - OR Vx, Vy, Set Vx = Vx OR Vy
+static void chip8_OpOR( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins->x] |= chip->registers.V_Registers[ins->y];
+}
+
+//8xy2 - AND Vx, Vy, Set Vx = Vx AND Vy
+static void chip8_OpAND( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins->x] &= chip->registers.V_Registers[ins->y];
+}
+
+//8xy3 - XOR Vx, Vy, Set Vx = Vx XOR Vy.
+static void chip8_OpXOR( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins->x] ^= chip->registers.V_Registers[ins->y];
+}
+
+//8xy4 - ADD Vx, Vy, Set Vx = Vx + Vy, set VF = carry.
+static void chip8_OpADD_VxVy( chip8 *chip, const chip8Instruction *ins) {
+    unsigned char *V = chip->registers.V_Registers;
+    unsigned short temp = V[ins->x] + V[ins->y];
+    V[0x0f] = temp > 0xff;
+    V[ins->x] = temp;
+}
+
+//8xy5 - SUB Vx, Vy, Set Vx = Vx - Vy, set VF = NOT borrow.
+static void chip8_OpSUB( chip8 *chip, const chip8Instruction *ins) {
+    unsigned char *V = chip->registers.V_Registers;
+    // VF is cleared before the compare, so x or y = F reads 0
+    V[0x0f] = 0;
+    V[0x0f] = V[ins->x] > V[ins->y];
+    V[ins->x] = V[ins->x] - V[ins->y];
+}
+
+//8xy6 - SHR Vx {, Vy}, Set Vx = Vx SHR 1.
+static void chip8_OpSHR( chip8 *chip, const chip8Instruction *ins) {
+    unsigned char *V = chip->registers.V_Registers;
+    V[0x0f] = V[ins->x] & 0x01;
+    V[ins->x] /= 2;
+}
+
+//8xy7 - SUBN Vx, Vy, Set Vx = Vy - Vx, set VF = NOT borrow.
+static void chip8_OpSUBN( chip8 *chip, const chip8Instruction *ins) {
+    unsigned char *V = chip->registers.V_Registers;
+    V[0x0f] = V[ins->y] > V[ins->x];
+    V[ins->x] = V[ins->y] - V[ins->x];
+}
+
+//8xyE - SHL Vx {, Vy}, Set Vx = Vx SHL 1.
+static void chip8_OpSHL( chip8 *chip, const chip8Instruction *ins) {
+    unsigned char *V = chip->registers.V_Registers;
+    V[0x0f] = V[ins->x] & 0b10000000;
+    V[ins->x] *= 2;
+}
+
+//9xy0 - SNE Vx, Vy, Skip next instruction if Vx != Vy.
+static void chip8_OpSNE_VxVy( chip8 *chip, const chip8Instruction *ins) {
+    if (chip->registers.V_Registers[ins->x] != chip->registers.V_Registers[ins->y]) {
+        chip->registers.PC += 2;
+    }
+}
+
+//Annn - LD I, addr, Set I = nnn
+static void chip8_OpLD_I( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.I_Register = ins->nnn;
+}
+
+//Bnnn - JP V0, addr, Jump to location nnn + V0
+static void chip8_OpJP_V0( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.PC = ins->nnn + chip->registers.V_Registers[0x00];
+}
+
+//Cxkk - RND Vx, byte, Set Vx = random byte AND kk.
+static void chip8_OpRND( chip8 *chip, const chip8Instruction *ins) {
+    uint64_t x = chip->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    chip->rng = x;
+    chip->registers.V_Registers[ins->x] = (unsigned char) ((x * 0x2545f4914f6cdd1d) >> 56) & ins->kk;
+}
+
+//Dxyn - DRW Vx, Vy, nibble, Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
+static void chip8_OpDRW( chip8 *chip, const chip8Instruction *ins) {
+    unsigned char scratch[CHIP8_SPRITE_MAX_ROWS];
+    const char *sprites = (const char*) chip8_GetMemSpan(&chip->memory, chip->registers.I_Register, ins->n, scratch);
+    chip->registers.V_Registers[0x0f] = chip8_ScreenDrawSprite(&chip->screen,
+                                                               chip->registers.V_Registers[ins->x],
+                                                               chip->registers.V_Registers[ins->y],
+                                                               sprites, ins->n);
+    chip8_ScreenChanged(chip);
+}
+
+//Ex9E - SKP Vx, Skip next instruction if key with the value of Vx is pressed
+static void chip8_OpSKP( chip8 *chip, const chip8Instruction *ins) {
+    if ( chip8_IsKeyDown( &chip->keyboard, chip->registers.V_Registers[ins->x])) {
+        chip->registers.PC += 2;
+    }
+}
+
+//ExA1 - SKNP Vx, Skip next instruction if key with the value of Vx is not pressed
+static void chip8_OpSKNP( chip8 *chip, const chip8Instruction *ins) {
+    if ( !chip8_IsKeyDown( &chip->keyboard, chip->registers.V_Registers[ins->x])) {
+        chip->registers.PC += 2;
+    }
+}
+
+//Fx07 - LD Vx, DT, Set Vx = delay timer value
+static void chip8_OpLD_VxDT( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins->x] = chip->registers.delay_timer;
+}
+
+//Fx0A - LD Vx, K, Wait for a key press, store the value of the key in Vx.
+static void chip8_OpLD_VxK( chip8 *chip, const chip8Instruction *ins) {
+    chip8Keyboard *keyboard = &chip->keyboard;
+    if (keyboard->wait_done) {
+        keyboard->wait_done = false;
+        chip->registers.V_Registers[ins->x] = keyboard->wait_key;
+        return;
+    }
+    // Waits without blocking: PC stays on Fx0A and the run loops return
+    // to the host until chip8_PutKeyDown ends the wait
+    keyboard->waiting = true;
+    chip->registers.PC -= 2;
+}
+
+//Fx15 - LD DT, Vx, Set delay timer = Vx.
+static void chip8_OpLD_DTVx( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.delay_timer = chip->registers.V_Registers[ins->x];
+}
+
+//Fx18 - LD ST, Vx, Set sound timer = Vx
+static void chip8_OpLD_STVx( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.sound_timer = chip->registers.V_Registers[ins->x];
+}
+
+//Fx1E - ADD I, Vx, Set I = I + Vx.
+static void chip8_OpADD_IVx( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.I_Register += chip->registers.V_Registers[ins->x];
+}
+
+//Fx29 - LD F, Vx, Set I = location of sprite for digit Vx.
+static void chip8_OpLD_FVx( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.I_Register = chip->registers.V_Registers[ins->x] * CHIP8_DEFAULT_SPRITE_HEIGHT;
+}
+
+//Fx33 - LD B, Vx, Store BCD representation of Vx in memory locations I, I+1, and I+2.
+static void chip8_OpLD_BVx( chip8 *chip, const chip8Instruction *ins) {
+    unsigned char val      = chip->registers.V_Registers[ins->x];
+    unsigned char hundered = val / 100;
+    unsigned char tenth    = val / 10 % 10;
+    unsigned char ones     = val % 10;
+    chip8_SetMem ( &chip->memory, chip->registers.I_Register, hundered);
+    chip8_SetMem ( &chip->memory, chip->registers.I_Register + 1, tenth);
+    chip8_SetMem ( &chip->memory, chip->registers.I_Register + 2, ones);
+}
+
+//Fx55 - LD [I], Vx, Store registers V0 through Vx in memory starting at location I
+static void chip8_OpLD_IVx( chip8 *chip, const chip8Instruction *ins) {
+    for (int i = 0; i <= ins->x; i++) {
+        chip8_SetMem( &chip->memory, chip->registers.I_Register + i, chip->registers.V_Registers[i]);
+    }
+}
+
+//Fx65 - LD Vx, [I], Read registers V0 through Vx from memory starting at location I
+static void chip8_OpLD_VxI( chip8 *chip, const chip8Instruction *ins) {
+    for (int i = 0; i <= ins->x; i++) {
+        chip->registers.V_Registers[i] = chip8_GetMem( &chip->memory, chip->registers.I_Register + i);
+    }
+}
+
+//-------------------------------------------------------------------
+// CHIP8 FUSED INSTRUCTION HANDLERS
+//-------------------------------------------------------------------
+// Fused handlers run ins[0] and ins[1] in one dispatch. They only run
+// from chip8_ExecuteBlock, with PC already past both instructions.
+
+//6xkk + Annn - LD Vx, byte then LD I, addr
+static void chip8_OpLD_VxKK_LD_I( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins[0].x] = ins[0].kk;
+    chip->registers.I_Register = ins[1].nnn;
+}
+
+//3xkk + 1nnn - SE Vx, byte then JP addr
+static void chip8_OpSE_VxKK_JP( chip8 *chip, const chip8Instruction *ins) {
+    if (chip->registers.V_Registers[ins[0].x] != ins[0].kk) {
+        chip->registers.PC = ins[1].nnn;
+    }
+}
+
+//4xkk + 1nnn - SNE Vx, byte then JP addr
+static void chip8_OpSNE_VxKK_JP( chip8 *chip, const chip8Instruction *ins) {
+    if (chip->registers.V_Registers[ins[0].x] == ins[0].kk) {
+        chip->registers.PC = ins[1].nnn;
+    }
+}
+
+//7xkk + 3xkk - ADD Vx, byte then SE Vx, byte
+static void chip8_OpADD_VxKK_SE( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins[0].x] += ins[0].kk;
+    if (chip->registers.V_Registers[ins[1].x] == ins[1].kk) {
+        chip->registers.PC += 2;
+    }
+}
+
+//7xkk + 4xkk - ADD Vx, byte then SNE Vx, byte
+static void chip8_OpADD_VxKK_SNE( chip8 *chip, const chip8Instruction *ins) {
+    chip->registers.V_Registers[ins[0].x] += ins[0].kk;
+    if (chip->registers.V_Registers[ins[1].x] != ins[1].kk) {
+        chip->registers.PC += 2;
+    }
+}
+
+//-------------------------------------------------------------------
+// CHIP8 DISPATCH TABLE
+//-------------------------------------------------------------------
+static void chip8_OpDecode( chip8 *chip, const chip8Instruction *ins);
+
+// Handler for every op id, indexed by chip8_Op
+static const chip8_OpHandler chip8_OpHandlers[CHIP8_OP_COUNT] = {
+    [CHIP8_OP_DECODE]    = chip8_OpDecode,
+    [CHIP8_OP_NOP]       = chip8_OpNOP,
+    [CHIP8_OP_CLS]       = chip8_OpCLS,
+    [CHIP8_OP_RET]       = chip8_OpRET,
+    [CHIP8_OP_JP]        = chip8_OpJP,
+    [CHIP8_OP_CALL]      = chip8_OpCALL,
+    [CHIP8_OP_SE_VX_KK]  = chip8_OpSE_VxKK,
+    [CHIP8_OP_SNE_VX_KK] = chip8_OpSNE_VxKK,
+    [CHIP8_OP_SE_VX_VY]  = chip8_OpSE_VxVy,
+    [CHIP8_OP_LD_VX_KK]  = chip8_OpLD_VxKK,
+    [CHIP8_OP_ADD_VX_KK] = chip8_OpADD_VxKK,
+    [CHIP8_OP_LD_VX_VY]  = chip8_OpLD_VxVy,
+    [CHIP8_OP_OR]        = chip8_OpOR,
+    [CHIP8_OP_AND]       = chip8_OpAND,
+    [CHIP8_OP_XOR]       = chip8_OpXOR,
+    [CHIP8_OP_ADD_VX_VY] = chip8_OpADD_VxVy,
+    [CHIP8_OP_SUB]       = chip8_OpSUB,
+    [CHIP8_OP_SHR]       = chip8_OpSHR,
+    [CHIP8_OP_SUBN]      = chip8_OpSUBN,
+    [CHIP8_OP_SHL]       = chip8_OpSHL,
+    [CHIP8_OP_SNE_VX_VY] = chip8_OpSNE_VxVy,
+    [CHIP8_OP_LD_I]      = chip8_OpLD_I,
+    [CHIP8_OP_JP_V0]     = chip8_OpJP_V0,
+    [CHIP8_OP_RND]       = chip8_OpRND,
+    [CHIP8_OP_DRW]       = chip8_OpDRW,
+    [CHIP8_OP_SKP]       = chip8_OpSKP,
+    [CHIP8_OP_SKNP]      = chip8_OpSKNP,
+    [CHIP8_OP_LD_VX_DT]  = chip8_OpLD_VxDT,
+    [CHIP8_OP_LD_VX_K]   = chip8_OpLD_VxK,
+    [CHIP8_OP_LD_DT_VX]  = chip8_OpLD_DTVx,
+    [CHIP8_OP_LD_ST_VX]  = chip8_OpLD_STVx,
+    [CHIP8_OP_ADD_I_VX]  = chip8_OpADD_IVx,
+    [CHIP8_OP_LD_F_VX]   = chip8_OpLD_FVx,
+    [CHIP8_OP_LD_B_VX]   = chip8_OpLD_BVx,
+    [CHIP8_OP_LD_I_VX]   = chip8_OpLD_IVx,
+    [CHIP8_OP_LD_VX_I]   = chip8_OpLD_VxI,
+    [CHIP8_OP_LD_VX_KK_LD_I] = chip8_OpLD_VxKK_LD_I,
+    [CHIP8_OP_SE_VX_KK_JP]   = chip8_OpSE_VxKK_JP,
+    [CHIP8_OP_SNE_VX_KK_JP]  = chip8_OpSNE_VxKK_JP,
+    [CHIP8_OP_ADD_VX_KK_SE]  = chip8_OpADD_VxKK_SE,
+    [CHIP8_OP_ADD_VX_KK_SNE] = chip8_OpADD_VxKK_SNE,
+};
+
+// Op id for every possible 16-bit opcode. One byte per entry keeps the
+// table at 64 KB; it is filled once by chip8_InitDispatch.
+static unsigned char chip8_OpTable[0x10000];
+enum { CHIP8_TABLE_EMPTY, CHIP8_TABLE_BUILDING, CHIP8_TABLE_READY };
+static int chip8_OpTableState = CHIP8_TABLE_EMPTY;
+
+// Classifies an opcode. Only used while building chip8_OpTable.
+static unsigned char chip8_ClassifyOpcode( unsigned short opcode) {
+
+    switch (opcode) {
+        case 0x00E0 : return CHIP8_OP_CLS;
+        case 0x00EE : return CHIP8_OP_RET;
+    }
 
     switch (opcode & 0xf000) {
-        // JP: jump to nnn addr 
-        case 0x1000 : 
-            chip->registers.PC = nnn;
-            break;
-        case 0x2000 :
-        // CALL: call a subroutine
-            chip8_StackPush(chip, chip->registers.PC);
-            chip->registers.PC = nnn;
-            break;
-        //3xkk - SE: skip next instruction
-        case 0x3000 :
-            if (chip->registers.V_Registers[x] == kk) {
-                chip->registers.PC += 2;
-            }
-            break;
-        //4xkk - SNE Vx, byte Skip next instruction if Vx != kk, increments the program counter by 2.
-        case 0x4000 : 
-            if (chip->registers.V_Registers[x] != kk) {
-                chip->registers.PC += 2;
-            }
-            break;
-        //5xy0 - SE Vx, Vy, Skip next instruction if Vx = Vy.
-        case 0x5000 : 
-            if (chip->registers.V_Registers[x] == chip->registers.V_Registers[y]) {
-                chip->registers.PC += 2;
-            }
-            break;
-        //6xkk - LD Vx, byte, Set Vx = kk.
-        case 0x6000 :
-            chip->registers.V_Registers[x] = kk;
-            break;
-        //7xkk - ADD Vx, byte, Set Vx = Vx + kk
-        case 0x7000 : 
-            chip->registers.V_Registers[x] += kk;
-            break;
-        //Instctrion starting from 8:
+        case 0x1000 : return CHIP8_OP_JP;
+        case 0x2000 : return CHIP8_OP_CALL;
+        case 0x3000 : return CHIP8_OP_SE_VX_KK;
+        case 0x4000 : return CHIP8_OP_SNE_VX_KK;
+        case 0x5000 : return CHIP8_OP_SE_VX_VY;
+        case 0x6000 : return CHIP8_OP_LD_VX_KK;
+        case 0x7000 : return CHIP8_OP_ADD_VX_KK;
         case 0x8000 :
-            chip8_ExecuteInstructionClassEight( chip, opcode);
-            break;
-        //9xy0 - SNE Vx, Vy, Skip next instruction if Vx != Vy.
-        case 0x9000 :
-            if ( chip->registers.V_Registers[x] != chip->registers.V_Registers[y] ) {
-                chip->registers.PC += 2;
-            }
-            break;
-        //Annn - LD I, addr, Set I = nnn
-        case 0xA000 :
-            chip->registers.I_Register = nnn;
-            break;
-        //Bnnn - JP V0, addr, Jump to location nnn + V0
-        case 0xB000 :
-            chip->registers.PC = nnn + chip->registers.V_Registers[0x00];
-            break;
-        //Cxkk - RND Vx, byte, Set Vx = random byte AND kk.
-        case 0xC000 :
-            srand( clock() );
-            chip->registers.V_Registers[x] = (rand() % 255) & kk;
-            break;
-        //Dxyn - DRW Vx, Vy, nibble, Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
-        case 0xD000 :
-            {
-            const char *sprites = (const char*) &chip->memory.RAM[chip->registers.I_Register];
-            chip->registers.V_Registers[0x0f] = chip8_ScreenDrawSprite(&chip->screen, chip->registers.V_Registers[x], chip->registers.V_Registers[y],sprites,n);
+            switch (opcode & 0x000f) {
+                case 0x00 : return CHIP8_OP_LD_VX_VY;
+                case 0x01 : return CHIP8_OP_OR;
+                case 0x02 : return CHIP8_OP_AND;
+                case 0x03 : return CHIP8_OP_XOR;
+                case 0x04 : return CHIP8_OP_ADD_VX_VY;
+                case 0x05 : return CHIP8_OP_SUB;
+                case 0x06 : return CHIP8_OP_SHR;
+                case 0x07 : return CHIP8_OP_SUBN;
+                case 0x0E : return CHIP8_OP_SHL;
             }
             break;
-        //Ex__ - Instructions starting with E : Keyboard operations
+        case 0x9000 : return CHIP8_OP_SNE_VX_VY;
+        case 0xA000 : return CHIP8_OP_LD_I;
+        case 0xB000 : return CHIP8_OP_JP_V0;
+        case 0xC000 : return CHIP8_OP_RND;
+        case 0xD000 : return CHIP8_OP_DRW;
         case 0xE000 :
-            {
-            switch( opcode & 0x00ff) {
-                //Ex9E - SKP Vx, Skip next instruction if key with the value of Vx is pressed
-                case 0x9e :
-                    if ( chip8_IsKeyDown( &chip->keyboard, chip->registers.V_Registers[x])) {
-                        chip->registers.PC += 2;
-                    }
-                    break;
-                //Ex9E - SKP Vx, Skip next instruction if key with the value of Vx is not pressed
-                case 0xa1 :
-                    if ( !chip8_IsKeyDown( &chip->keyboard, chip->registers.V_Registers[x])) {
-                        chip->registers.PC += 2;
-                    }
-                    break;
-                }
-
+            switch (opcode & 0x00ff) {
+                case 0x9E : return CHIP8_OP_SKP;
+                case 0xA1 : return CHIP8_OP_SKNP;
             }
             break;
         case 0xF000 :
-            chip8_ExecuteInstructionClassF_instruction( chip, opcode);
+            switch (opcode & 0x00ff) {
+                case 0x07 : return CHIP8_OP_LD_VX_DT;
+                case 0x0A : return CHIP8_OP_LD_VX_K;
+                case 0x15 : return CHIP8_OP_LD_DT_VX;
+                case 0x18 : return CHIP8_OP_LD_ST_VX;
+                case 0x1E : return CHIP8_OP_ADD_I_VX;
+                case 0x29 : return CHIP8_OP_LD_F_VX;
+                case 0x33 : return CHIP8_OP_LD_B_VX;
+                case 0x55 : return CHIP8_OP_LD_I_VX;
+                case 0x65 : return CHIP8_OP_LD_VX_I;
+            }
             break;
+    }
+    return CHIP8_OP_NOP;
+}
 
+void chip8_InitDispatch( void ) {
+    // The first caller builds the table, threads that arrive meanwhile wait
+    // for the release store so they never see a half-built table
+    int state = CHIP8_TABLE_EMPTY;
+    if (__atomic_compare_exchange_n(&chip8_OpTableState, &state, CHIP8_TABLE_BUILDING, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        for (int opcode = 0; opcode <= 0xffff; opcode++) {
+            chip8_OpTable[opcode] = chip8_ClassifyOpcode(opcode);
+        }
+        __atomic_store_n(&chip8_OpTableState, CHIP8_TABLE_READY, __ATOMIC_RELEASE);
+        return;
     }
+    while (__atomic_load_n(&chip8_OpTableState, __ATOMIC_ACQUIRE) != CHIP8_TABLE_READY)
+        ;
+}
+
+unsigned char chip8_GetOp( unsigned short opcode) {
+    return chip8_OpTable[opcode];
+}
+
+static const char *chip8_OpNames[CHIP8_OP_COUNT] = {
+    [CHIP8_OP_DECODE]    = "DECODE",
+    [CHIP8_OP_NOP]       = "SYS/unknown",
+    [CHIP8_OP_CLS]       = "00E0 CLS",
+    [CHIP8_OP_RET]       = "00EE RET",
+    [CHIP8_OP_JP]        = "1nnn JP",
+    [CHIP8_OP_CALL]      = "2nnn CALL",
+    [CHIP8_OP_SE_VX_KK]  = "3xkk SE",
+    [CHIP8_OP_SNE_VX_KK] = "4xkk SNE",
+    [CHIP8_OP_SE_VX_VY]  = "5xy0 SE",
+    [CHIP8_OP_LD_VX_KK]  = "6xkk LD",
+    [CHIP8_OP_ADD_VX_KK] = "7xkk ADD",
+    [CHIP8_OP_LD_VX_VY]  = "8xy0 LD",
+    [CHIP8_OP_OR]        = "8xy1 OR",
+    [CHIP8_OP_AND]       = "8xy2 AND",
+    [CHIP8_OP_XOR]       = "8xy3 XOR",
+    [CHIP8_OP_ADD_VX_VY] = "8xy4 ADD",
+    [CHIP8_OP_SUB]       = "8xy5 SUB",
+    [CHIP8_OP_SHR]       = "8xy6 SHR",
+    [CHIP8_OP_SUBN]      = "8xy7 SUBN",
+    [CHIP8_OP_SHL]       = "8xyE SHL",
+    [CHIP8_OP_SNE_VX_VY] = "9xy0 SNE",
+    [CHIP8_OP_LD_I]      = "Annn LD I",
+    [CHIP8_OP_JP_V0]     = "Bnnn JP V0",
+    [CHIP8_OP_RND]       = "Cxkk RND",
+    [CHIP8_OP_DRW]       = "Dxyn DRW",
+    [CHIP8_OP_SKP]       = "Ex9E SKP",
+    [CHIP8_OP_SKNP]      = "ExA1 SKNP",
+    [CHIP8_OP_LD_VX_DT]  = "Fx07 LD DT",
+    [CHIP8_OP_LD_VX_K]   = "Fx0A LD K",
+    [CHIP8_OP_LD_DT_VX]  = "Fx15 LD DT",
+    [CHIP8_OP_LD_ST_VX]  = "Fx18 LD ST",
+    [CHIP8_OP_ADD_I_VX]  = "Fx1E ADD I",
+    [CHIP8_OP_LD_F_VX]   = "Fx29 LD F",
+    [CHIP8_OP_LD_B_VX]   = "Fx33 LD B",
+    [CHIP8_OP_LD_I_VX]   = "Fx55 LD [I]",
+    [CHIP8_OP_LD_VX_I]   = "Fx65 LD Vx",
+    [CHIP8_OP_LD_VX_KK_LD_I] = "6xkk+Annn",
+    [CHIP8_OP_SE_VX_KK_JP]   = "3xkk+1nnn",
+    [CHIP8_OP_SNE_VX_KK_JP]  = "4xkk+1nnn",
+    [CHIP8_OP_ADD_VX_KK_SE]  = "7xkk+3xkk",
+    [CHIP8_OP_ADD_VX_KK_SNE] = "7xkk+4xkk",
+};
+
+const char * chip8_GetOpName( unsigned char op) {
+    return op < CHIP8_OP_COUNT ? chip8_OpNames[op] : "?";
+}
+
+chip8_OpHandler chip8_GetHandler( unsigned char op) {
+    return chip8_OpHandlers[op];
+}
+
+void chip8_DecodeInstruction( unsigned short opcode, chip8Instruction *ins) {
+    ins->opcode = opcode;
+    ins->nnn    = opcode & 0x0fff;
+    ins->op     = chip8_OpTable[opcode];
+    ins->x      = (opcode >> 8) & 0x000f;
+    ins->y      = (opcode >> 4) & 0x000f;
+    ins->kk     = opcode & 0x00ff;
+    ins->n      = opcode & 0x000f;
+    ins->block_op = ins->op;
+}
+
+// Handler of an empty cache slot: decodes the slot in place, then runs it
+static void chip8_OpDecode( chip8 *chip, const chip8Instruction *ins) {
+    int slot = ins - chip->memory.decoded;
+    chip8_DecodeInstruction( chip8_FetchInstructionMem(&chip->memory, slot * 2), &chip->memory.decoded[slot]);
+    chip8_OpHandlers[chip->memory.decoded[slot].op](chip, &chip->memory.decoded[slot]);
 }
 
 void chip8_ExecuteInstruction ( chip8 *chip, unsigned short opcode) {
+    // callers have already moved PC past the instruction
+    CHIP8_PROFILE_COUNT(chip->registers.PC - 2, opcode);
+    chip8Instruction ins;
+    chip8_DecodeInstruction(opcode, &ins);
+    chip8_OpHandlers[ins.op](chip, &ins);
+}
 
-    switch (opcode) {
-        // CLS : clears screen
-        case 0x00E0 :
-            chip8_ScreenClear(&chip->screen);
-            break;
-        // RED : returns from subroutine
-        case 0x00EE : 
-            chip->registers.PC = chip8_StackPop(chip);
+static inline void chip8_StepOne ( chip8 *chip) {
+    unsigned short pc = chip->registers.PC;
+    chip->registers.PC += 2;
+
+    // Only even addresses have a cache slot
+    if (pc & 1) {
+        chip8_ExecuteInstruction(chip, chip8_FetchInstructionMem(&chip->memory, pc));
+        return;
+    }
+    chip8_CheckMemIndexBound(pc + 1);
+    CHIP8_PROFILE_COUNT(pc, chip8_FetchInstructionMem(&chip->memory, pc));
+    const chip8Instruction *ins = &chip8_GetDecoded(&chip->memory)[pc >> 1];
+    chip8_OpHandlers[ins->op](chip, ins);
+}
+
+void chip8_Step ( chip8 *chip) {
+#ifdef CHIP8_TRACE
+    if (chip->trace) {
+        chip8TraceMark mark;
+        chip8_TraceBefore(chip, &mark);
+        chip8_StepOne(chip);
+        chip8_TraceAfter(chip, &mark);
+        return;
+    }
+#endif
+    chip8_StepOne(chip);
+}
+
+//-------------------------------------------------------------------
+// CHIP8 BLOCK CACHE
+//-------------------------------------------------------------------
+// Ops that end a block: anything that may move PC other than by 2,
+// wait on the host, or rewrite memory that is already in the block
+bool chip8_IsBlockEnd( unsigned char op) {
+    switch (op) {
+        case CHIP8_OP_RET :
+        case CHIP8_OP_JP :
+        case CHIP8_OP_CALL :
+        case CHIP8_OP_SE_VX_KK :
+        case CHIP8_OP_SNE_VX_KK :
+        case CHIP8_OP_SE_VX_VY :
+        case CHIP8_OP_SNE_VX_VY :
+        case CHIP8_OP_JP_V0 :
+        case CHIP8_OP_SKP :
+        case CHIP8_OP_SKNP :
+        case CHIP8_OP_LD_VX_K :
+        case CHIP8_OP_LD_B_VX :
+        case CHIP8_OP_LD_I_VX :
+            return true;
+    }
+    return false;
+}
+
+static chip8Instruction * chip8_DecodeSlot( chip8Mem *memory, int slot) {
+    chip8Instruction *ins = &memory->decoded[slot];
+    if (ins->op == CHIP8_OP_DECODE)
+        chip8_DecodeInstruction( chip8_FetchInstructionMem(memory, slot * 2), ins);
+    return ins;
+}
+
+// Fused op for a pair of ops, or first when the pair does not fuse
+static unsigned char chip8_FuseOps( unsigned char first, unsigned char second) {
+    if (first == CHIP8_OP_LD_VX_KK && second == CHIP8_OP_LD_I)
+        return CHIP8_OP_LD_VX_KK_LD_I;
+    if (first == CHIP8_OP_SE_VX_KK && second == CHIP8_OP_JP)
+        return CHIP8_OP_SE_VX_KK_JP;
+    if (first == CHIP8_OP_SNE_VX_KK && second == CHIP8_OP_JP)
+        return CHIP8_OP_SNE_VX_KK_JP;
+    if (first == CHIP8_OP_ADD_VX_KK && second == CHIP8_OP_SE_VX_KK)
+        return CHIP8_OP_ADD_VX_KK_SE;
+    if (first == CHIP8_OP_ADD_VX_KK && second == CHIP8_OP_SNE_VX_KK)
+        return CHIP8_OP_ADD_VX_KK_SNE;
+    return first;
+}
+
+// True if slot holds 3xkk/4xkk followed by a jump the skip can fuse with.
+// Not when the jump goes to its own next address: chip8_ExecuteBlock tells
+// a taken skip from the jump by PC.
+static bool chip8_IsFusedSkipJump( chip8Mem *memory, int slot) {
+    if (slot + 1 >= CHIP8_MEM_SIZE / 2)
+        return false;
+    unsigned char op = chip8_DecodeSlot(memory, slot)->op;
+    if (op != CHIP8_OP_SE_VX_KK && op != CHIP8_OP_SNE_VX_KK)
+        return false;
+    const chip8Instruction *next = chip8_DecodeSlot(memory, slot + 1);
+    return next->op == CHIP8_OP_JP && next->nnn != (slot + 2) * 2;
+}
+
+// Decodes the straight-line run starting at slot, records its length and
+// fuses common pairs inside it
+static void chip8_BuildBlock( chip8Mem *memory, int slot) {
+    int len = 0;
+    chip8Instruction *ins = NULL;
+    while (len < CHIP8_BLOCK_MAX_LEN && slot + len < CHIP8_MEM_SIZE / 2) {
+        ins = chip8_DecodeSlot(memory, slot + len);
+        len++;
+        if (chip8_IsBlockEnd(ins->op))
             break;
-        default:
-            chip8_ExecuteInstructionExtended(chip, opcode);
-            
-    }    
+    }
+
+    // A 3xkk/4xkk skip over a jump takes the jump into the block so the
+    // pair can fuse
+    if (len < CHIP8_BLOCK_MAX_LEN && chip8_IsFusedSkipJump(memory, slot + len - 1))
+        len++;
+
+    ins = &memory->decoded[slot];
+    for (int i = 0; i + 1 < len; i++) {
+        unsigned char op = chip8_FuseOps(ins[i].op, ins[i + 1].op);
+        // ADD+skip moves PC as the last instruction of its block; slots are
+        // shared between blocks, so never fuse it where any block could
+        // append the jump after the skip
+        if ((op == CHIP8_OP_ADD_VX_KK_SE || op == CHIP8_OP_ADD_VX_KK_SNE) &&
+            chip8_IsFusedSkipJump(memory, slot + i + 1))
+            op = ins[i].op;
+        ins[i].block_op = op;
+    }
+    ins[len - 1].block_op = ins[len - 1].op;
+    ins[0].block_len = len;
+}
+
+const chip8Instruction * chip8_GetBlock ( chip8Mem *memory, int pc) {
+    int slot = pc >> 1;
+    chip8Instruction *decoded = chip8_GetDecoded(memory);
+    if (decoded[slot].block_len == 0)
+        chip8_BuildBlock(memory, slot);
+    return &decoded[slot];
+}
+
+int chip8_ExecuteBlock ( chip8 *chip, int max) {
+    unsigned short pc = chip->registers.PC;
+#ifdef CHIP8_TRACE
+    // traced one instruction at a time, fused pairs hide the state between them
+    if (chip->trace) {
+        chip8_Step(chip);
+        return 1;
+    }
+#endif
+    if (pc & 1) {
+        chip8_Step(chip);
+        return 1;
+    }
+    chip8_CheckMemIndexBound(pc + 1);
+
+    const chip8Instruction *ins = chip8_GetBlock(&chip->memory, pc);
+    int len = ins->block_len < max ? ins->block_len : max;
+#ifdef CHIP8_PROFILE
+    const chip8Instruction *block = ins;
+#endif
+
+    // Only the last instruction of a block reads or moves PC, so PC is
+    // advanced once up front
+    const chip8Instruction *end = ins + len;
+    unsigned char op = CHIP8_OP_NOP;
+    chip->registers.PC = pc + 2 * len;
+
+    // A fused op covers its slot and the next one. The last slot always
+    // runs unfused, so a block cut short by max never runs half a pair.
+    while (ins + 1 < end) {
+        op = ins->block_op;
+        chip8_OpHandlers[op](chip, ins);
+        ins += op >= CHIP8_OP_FUSED ? 2 : 1;
+    }
+    if (ins < end) {
+        op = ins->op;
+        chip8_OpHandlers[op](chip, ins);
+    }
+
+    // A fused skip that skipped its jump ran one instruction less
+    if ((op == CHIP8_OP_SE_VX_KK_JP || op == CHIP8_OP_SNE_VX_KK_JP) && chip->registers.PC == pc + 2 * len)
+        len--;
+#ifdef CHIP8_PROFILE
+    // slot opcodes survive a rewrite by the block, only op is reset
+    for (int i = 0; i < len; i++) {
+        CHIP8_PROFILE_COUNT(pc + 2 * i, block[i].opcode);
+    }
+#endif
+    return len;
+}
+
+int chip8_Run ( chip8 *chip, int cycles) {
+    int executed = 0;
+    while (executed < cycles && !chip->keyboard.waiting) {
+        executed += chip8_ExecuteBlock(chip, cycles - executed);
+    }
+    return executed;
 }
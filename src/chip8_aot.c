@@ -0,0 +1,416 @@
+#include "../include/chip8.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+//-----------------------------------------------------------------
+// CHIP8 AOT RECOMPILER
+//-----------------------------------------------------------------
+// Reads a ROM, recovers its control flow from CHIP8_PROGRAM_LOAD_ADDR
+// and writes a C file defining chip8_AotRun (see chip8_aot.h).
+//
+//   chip8aot <rom> <output.c>
+
+// Per address flags filled by control flow recovery
+#define AOT_CODE   0x01    // first byte of a reachable instruction
+#define AOT_LEADER 0x02    // first instruction of a block
+
+static unsigned char flags[CHIP8_MEM_SIZE];
+static const unsigned char *rom;
+static long rom_size;
+
+static bool chip8_AotInRom( int addr) {
+    return addr >= CHIP8_PROGRAM_LOAD_ADDR && addr + 1 < CHIP8_PROGRAM_LOAD_ADDR + rom_size;
+}
+
+static void chip8_AotDecode( int addr, chip8Instruction *ins) {
+    const unsigned char *p = &rom[addr - CHIP8_PROGRAM_LOAD_ADDR];
+    chip8_DecodeInstruction( (p[0] << 8) | p[1], ins);
+}
+
+static bool chip8_AotIsSkip( unsigned char op) {
+    return op == CHIP8_OP_SE_VX_KK || op == CHIP8_OP_SNE_VX_KK ||
+           op == CHIP8_OP_SE_VX_VY || op == CHIP8_OP_SNE_VX_VY ||
+           op == CHIP8_OP_SKP || op == CHIP8_OP_SKNP;
+}
+
+//-----------------------------------------------------------------
+// CONTROL FLOW RECOVERY
+//-----------------------------------------------------------------
+static int worklist[CHIP8_MEM_SIZE];
+static int worklist_len;
+
+static void chip8_AotVisit( int addr) {
+    if (!chip8_AotInRom(addr))
+        return;
+    flags[addr] |= AOT_LEADER;
+    if (!(flags[addr] & AOT_CODE) && worklist_len < CHIP8_MEM_SIZE)
+        worklist[worklist_len++] = addr;
+}
+
+// Follows every direct jump, call, return site and skip. Bnnn targets
+// are unknown and are left to the runtime fallback.
+static void chip8_AotRecoverFlow( void ) {
+    chip8_AotVisit(CHIP8_PROGRAM_LOAD_ADDR);
+
+    while (worklist_len > 0) {
+        int addr = worklist[--worklist_len];
+        if (flags[addr] & AOT_CODE)
+            continue;
+        flags[addr] |= AOT_CODE;
+
+        chip8Instruction ins;
+        chip8_AotDecode(addr, &ins);
+        switch (ins.op) {
+            case CHIP8_OP_JP :
+                chip8_AotVisit(ins.nnn);
+                break;
+            case CHIP8_OP_CALL :
+                chip8_AotVisit(ins.nnn);
+                chip8_AotVisit(addr + 2);
+                break;
+            case CHIP8_OP_RET :
+            case CHIP8_OP_JP_V0 :
+                break;
+            default :
+                if (chip8_AotIsSkip(ins.op)) {
+                    chip8_AotVisit(addr + 2);
+                    chip8_AotVisit(addr + 4);
+                } else if (chip8_IsBlockEnd(ins.op)) {
+                    chip8_AotVisit(addr + 2);
+                } else if (chip8_AotInRom(addr + 2) && !(flags[addr + 2] & AOT_CODE)) {
+                    worklist[worklist_len++] = addr + 2;
+                }
+                break;
+        }
+    }
+}
+
+// Instructions in the block starting at a leader
+static int chip8_AotBlockLen( int addr) {
+    int len = 0;
+    do {
+        chip8Instruction ins;
+        chip8_AotDecode(addr, &ins);
+        len++;
+        addr += 2;
+        if (chip8_IsBlockEnd(ins.op))
+            break;
+    } while (addr < CHIP8_MEM_SIZE && (flags[addr] & AOT_CODE) && !(flags[addr] & AOT_LEADER) && len < 255);
+    return len;
+}
+
+//-----------------------------------------------------------------
+// C EMITTER
+//-----------------------------------------------------------------
+// Continues at addr: a direct goto when addr is a translated block,
+// otherwise through the dispatch switch
+static void chip8_AotEmitGoto( FILE *out, int addr) {
+    if (chip8_AotInRom(addr) && (flags[addr] & AOT_LEADER))
+        fprintf(out, "            goto L_%03x;\n", addr);
+    else
+        fprintf(out, "            continue;\n");
+}
+
+static void chip8_AotEmitSkip( FILE *out, const char *cond, int next) {
+    fprintf(out, "            r->PC = (%s) ? 0x%03x : 0x%03x;\n", cond, next + 2, next);
+    fprintf(out, "            continue;\n");
+}
+
+// Emits one instruction. Terminators also emit the PC update and leave the block.
+static void chip8_AotEmitInstruction( FILE *out, int addr, int block_len) {
+    chip8Instruction ins;
+    chip8_AotDecode(addr, &ins);
+    int x = ins.x, y = ins.y, next = addr + 2;
+    char cond[64];
+
+    fprintf(out, "            // %03x: %04X\n", addr, ins.opcode);
+    switch (ins.op) {
+        case CHIP8_OP_NOP :
+            break;
+        case CHIP8_OP_CLS :
+            fprintf(out, "            chip8_ScreenClear(&chip->screen);\n");
+            fprintf(out, "            chip8_ScreenChanged(chip);\n");
+            break;
+        case CHIP8_OP_RET :
+            fprintf(out, "            executed += %d;\n", block_len);
+            fprintf(out, "            r->PC = chip8_StackPop(chip);\n");
+            fprintf(out, "            continue;\n");
+            return;
+        case CHIP8_OP_JP :
+            fprintf(out, "            executed += %d;\n", block_len);
+            fprintf(out, "            r->PC = 0x%03x;\n", ins.nnn);
+            chip8_AotEmitGoto(out, ins.nnn);
+            return;
+        case CHIP8_OP_CALL :
+            fprintf(out, "            executed += %d;\n", block_len);
+            fprintf(out, "            chip8_StackPush(chip, 0x%03x);\n", next);
+            fprintf(out, "            r->PC = 0x%03x;\n", ins.nnn);
+            chip8_AotEmitGoto(out, ins.nnn);
+            return;
+        case CHIP8_OP_JP_V0 :
+            fprintf(out, "            executed += %d;\n", block_len);
+            fprintf(out, "            r->PC = 0x%03x + V[0x0];\n", ins.nnn);
+            fprintf(out, "            continue;\n");
+            return;
+        case CHIP8_OP_SE_VX_KK :
+        case CHIP8_OP_SNE_VX_KK :
+            snprintf(cond, sizeof(cond), "V[0x%x] %s 0x%02x", x, ins.op == CHIP8_OP_SE_VX_KK ? "==" : "!=", ins.kk);
+            fprintf(out, "            executed += %d;\n", block_len);
+            chip8_AotEmitSkip(out, cond, next);
+            return;
+        case CHIP8_OP_SE_VX_VY :
+        case CHIP8_OP_SNE_VX_VY :
+            snprintf(cond, sizeof(cond), "V[0x%x] %s V[0x%x]", x, ins.op == CHIP8_OP_SE_VX_VY ? "==" : "!=", y);
+            fprintf(out, "            executed += %d;\n", block_len);
+            chip8_AotEmitSkip(out, cond, next);
+            return;
+        case CHIP8_OP_SKP :
+        case CHIP8_OP_SKNP :
+            snprintf(cond, sizeof(cond), "%schip8_IsKeyDown(&chip->keyboard, V[0x%x])", ins.op == CHIP8_OP_SKP ? "" : "!", x);
+            fprintf(out, "            executed += %d;\n", block_len);
+            chip8_AotEmitSkip(out, cond, next);
+            return;
+        case CHIP8_OP_LD_VX_KK :
+            fprintf(out, "            V[0x%x] = 0x%02x;\n", x, ins.kk);
+            break;
+        case CHIP8_OP_ADD_VX_KK :
+            fprintf(out, "            V[0x%x] += 0x%02x;\n", x, ins.kk);
+            break;
+        case CHIP8_OP_LD_VX_VY :
+            fprintf(out, "            V[0x%x] = V[0x%x];\n", x, y);
+            break;
+        case CHIP8_OP_OR :
+            fprintf(out, "            V[0x%x] |= V[0x%x];\n", x, y);
+            break;
+        case CHIP8_OP_AND :
+            fprintf(out, "            V[0x%x] &= V[0x%x];\n", x, y);
+            break;
+        case CHIP8_OP_XOR :
+            fprintf(out, "            V[0x%x] ^= V[0x%x];\n", x, y);
+            break;
+        case CHIP8_OP_ADD_VX_VY :
+            fprintf(out, "            { unsigned short t = V[0x%x] + V[0x%x]; V[0xf] = t > 0xff; V[0x%x] = t; }\n", x, y, x);
+            break;
+        case CHIP8_OP_SUB :
+            fprintf(out, "            V[0xf] = 0; V[0xf] = V[0x%x] > V[0x%x]; V[0x%x] = V[0x%x] - V[0x%x];\n", x, y, x, x, y);
+            break;
+        case CHIP8_OP_SHR :
+            fprintf(out, "            V[0xf] = V[0x%x] & 0x01; V[0x%x] /= 2;\n", x, x);
+            break;
+        case CHIP8_OP_SUBN :
+            fprintf(out, "            V[0xf] = V[0x%x] > V[0x%x]; V[0x%x] = V[0x%x] - V[0x%x];\n", y, x, x, y, x);
+            break;
+        case CHIP8_OP_SHL :
+            fprintf(out, "            V[0xf] = V[0x%x] & 0x80; V[0x%x] *= 2;\n", x, x);
+            break;
+        case CHIP8_OP_LD_I :
+            fprintf(out, "            r->I_Register = 0x%03x;\n", ins.nnn);
+            break;
+        case CHIP8_OP_DRW :
+            fprintf(out, "            V[0xf] = chip8_ScreenDrawSprite(&chip->screen, V[0x%x], V[0x%x], "
+                         "(const char *) chip8_GetMemSpan(&chip->memory, r->I_Register, %d, sprite), %d);\n", x, y, ins.n, ins.n);
+            fprintf(out, "            chip8_ScreenChanged(chip);\n");
+            break;
+        case CHIP8_OP_LD_VX_DT :
+            fprintf(out, "            V[0x%x] = r->delay_timer;\n", x);
+            break;
+        case CHIP8_OP_LD_DT_VX :
+            fprintf(out, "            r->delay_timer = V[0x%x];\n", x);
+            break;
+        case CHIP8_OP_LD_ST_VX :
+            fprintf(out, "            r->sound_timer = V[0x%x];\n", x);
+            break;
+        case CHIP8_OP_ADD_I_VX :
+            fprintf(out, "            r->I_Register += V[0x%x];\n", x);
+            break;
+        case CHIP8_OP_LD_F_VX :
+            fprintf(out, "            r->I_Register = V[0x%x] * CHIP8_DEFAULT_SPRITE_HEIGHT;\n", x);
+            break;
+        case CHIP8_OP_LD_VX_I :
+            fprintf(out, "            for (int i = 0; i <= 0x%x; i++) V[i] = chip8_GetMem(&chip->memory, r->I_Register + i);\n", x);
+            break;
+        // Stores may rewrite translated code, so the blocks are re-checked
+        case CHIP8_OP_LD_B_VX :
+            fprintf(out, "            executed += %d;\n", block_len);
+            fprintf(out, "            r->PC = 0x%03x;\n", next);
+            fprintf(out, "            chip8_SetMem(&chip->memory, r->I_Register, V[0x%x] / 100);\n", x);
+            fprintf(out, "            chip8_SetMem(&chip->memory, r->I_Register + 1, V[0x%x] / 10 %% 10);\n", x);
+            fprintf(out, "            chip8_SetMem(&chip->memory, r->I_Register + 2, V[0x%x] %% 10);\n", x);
+            fprintf(out, "            chip8_AotCheck(chip, stale, r->I_Register, r->I_Register + 2);\n");
+            chip8_AotEmitGoto(out, next);
+            return;
+        case CHIP8_OP_LD_I_VX :
+            fprintf(out, "            executed += %d;\n", block_len);
+            fprintf(out, "            r->PC = 0x%03x;\n", next);
+            fprintf(out, "            for (int i = 0; i <= 0x%x; i++) chip8_SetMem(&chip->memory, r->I_Register + i, V[i]);\n", x);
+            fprintf(out, "            chip8_AotCheck(chip, stale, r->I_Register, r->I_Register + 0x%x);\n", x);
+            chip8_AotEmitGoto(out, next);
+            return;
+        // Rare ops call their handler, translated code is not counted by the profiler
+        default :
+            fprintf(out, "            r->PC = 0x%03x;\n", next);
+            fprintf(out, "            { chip8Instruction ins; chip8_DecodeInstruction(0x%04X, &ins); "
+                         "chip8_GetHandler(ins.op)(chip, &ins); }\n", ins.opcode);
+            if (chip8_IsBlockEnd(ins.op)) {
+                fprintf(out, "            executed += %d;\n", block_len);
+                fprintf(out, "            continue;\n");
+                return;
+            }
+            break;
+    }
+}
+
+static void chip8_AotEmit( FILE *out, const char *rom_name) {
+    int blocks = 0;
+    for (int addr = 0; addr < CHIP8_MEM_SIZE; addr++) {
+        if ((flags[addr] & AOT_LEADER) && (flags[addr] & AOT_CODE))
+            blocks++;
+    }
+
+    fprintf(out, "// Generated by chip8aot from %s, do not edit\n", rom_name);
+    fprintf(out, "#include \"chip8_aot.h\"\n\n");
+    // every block gets a label, most are only reached through the switch
+    fprintf(out, "#ifdef __GNUC__\n#pragma GCC diagnostic ignored \"-Wunused-label\"\n#endif\n\n");
+
+    fprintf(out, "static const unsigned char chip8_aot_rom[%ld] = {", rom_size);
+    for (long i = 0; i < rom_size; i++) {
+        fprintf(out, "%s0x%02x,", i % 16 ? " " : "\n    ", rom[i]);
+    }
+    fprintf(out, "\n};\n\n");
+
+    // Block table, used to find blocks whose code no longer matches the ROM
+    fprintf(out, "#define CHIP8_AOT_BLOCKS %d\n", blocks);
+    fprintf(out, "static const unsigned short chip8_aot_block_addr[CHIP8_AOT_BLOCKS + 1] = {");
+    for (int addr = 0, b = 0; addr < CHIP8_MEM_SIZE; addr++) {
+        if ((flags[addr] & AOT_LEADER) && (flags[addr] & AOT_CODE))
+            fprintf(out, "%s0x%03x,", b++ % 8 ? " " : "\n    ", addr);
+    }
+    fprintf(out, "\n};\n");
+    fprintf(out, "static const unsigned char chip8_aot_block_len[CHIP8_AOT_BLOCKS + 1] = {");
+    for (int addr = 0, b = 0; addr < CHIP8_MEM_SIZE; addr++) {
+        if ((flags[addr] & AOT_LEADER) && (flags[addr] & AOT_CODE))
+            fprintf(out, "%s%d,", b++ % 16 ? " " : "\n    ", chip8_AotBlockLen(addr));
+    }
+    fprintf(out, "\n};\n");
+
+    // Blocks are sorted and do not overlap, so the ones touching a page are a
+    // range. first and end only grow from page to page, an empty page gets an
+    // empty range where its blocks would be.
+    fprintf(out, "// Blocks [first, end) touching each RAM page\n");
+    fprintf(out, "static const unsigned short chip8_aot_page_blocks[CHIP8_PAGE_COUNT][2] = {");
+    for (int page = 0; page < CHIP8_PAGE_COUNT; page++) {
+        int start = page * CHIP8_PAGE_SIZE, stop = start + CHIP8_PAGE_SIZE;
+        int first = 0, end = 0;
+        for (int addr = 0; addr < CHIP8_MEM_SIZE; addr++) {
+            if (!(flags[addr] & AOT_LEADER) || !(flags[addr] & AOT_CODE))
+                continue;
+            if (addr + chip8_AotBlockLen(addr) * 2 <= start)
+                first++;
+            if (addr < stop)
+                end++;
+        }
+        fprintf(out, "%s{ %d, %d },", page % 8 ? " " : "\n    ", first, end);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out,
+        "// Marks the blocks overlapping [lo, hi] whose bytes in RAM differ from the ROM\n"
+        "static void chip8_AotCheck( chip8 *chip, bool *stale, int lo, int hi) {\n"
+        "    if (hi >= CHIP8_MEM_SIZE)\n"
+        "        hi = CHIP8_MEM_SIZE - 1;\n"
+        "    int first = chip8_aot_page_blocks[lo / CHIP8_PAGE_SIZE][0];\n"
+        "    int end   = chip8_aot_page_blocks[hi / CHIP8_PAGE_SIZE][1];\n"
+        "    for (int b = first; b < end; b++) {\n"
+        "        int addr = chip8_aot_block_addr[b];\n"
+        "        int len = chip8_aot_block_len[b] * 2;\n"
+        "        if (addr > hi || addr + len <= lo)\n"
+        "            continue;\n"
+        "        unsigned char scratch[255 * 2];\n"
+        "        stale[b] = memcmp(chip8_GetMemSpan(&chip->memory, addr, len, scratch),\n"
+        "                          &chip8_aot_rom[addr - CHIP8_PROGRAM_LOAD_ADDR], len) != 0;\n"
+        "    }\n"
+        "}\n\n");
+
+    fprintf(out,
+        "int chip8_AotRun ( chip8 *chip, int cycles) {\n"
+        "    chip8Registers *r = &chip->registers;\n"
+        "    unsigned char *V = r->V_Registers;\n"
+        "    bool stale[CHIP8_AOT_BLOCKS + 1];\n"
+        "    // scratch for Dxyn, unused by ROMs that never draw\n"
+        "    unsigned char sprite[CHIP8_SPRITE_MAX_ROWS];\n"
+        "    (void) sprite;\n"
+        "    int executed = 0;\n"
+        "\n"
+        "    // RAM may have changed since the last call\n"
+        "    chip8_AotCheck(chip, stale, 0, CHIP8_MEM_SIZE - 1);\n"
+        "    while (executed < cycles && !chip->keyboard.waiting) {\n"
+        "        switch (r->PC) {\n");
+
+    for (int addr = 0, b = 0; addr < CHIP8_MEM_SIZE; addr++) {
+        if (!(flags[addr] & AOT_LEADER) || !(flags[addr] & AOT_CODE))
+            continue;
+        int len = chip8_AotBlockLen(addr);
+        fprintf(out, "        case 0x%03x: L_%03x:\n", addr, addr);
+        fprintf(out, "            if (stale[%d] || cycles - executed < %d)\n", b++, len);
+        fprintf(out, "                break;\n");
+
+        int pc = addr;
+        for (int i = 0; i < len; i++, pc += 2) {
+            chip8_AotEmitInstruction(out, pc, len);
+        }
+        // Block cut by a leader or the end of the code: falls through
+        chip8Instruction last;
+        chip8_AotDecode(pc - 2, &last);
+        if (!chip8_IsBlockEnd(last.op)) {
+            fprintf(out, "            executed += %d;\n", len);
+            fprintf(out, "            r->PC = 0x%03x;\n", pc);
+            chip8_AotEmitGoto(out, pc);
+        }
+    }
+
+    fprintf(out,
+        "        }\n"
+        "        // A goto chain can end here with the budget already spent\n"
+        "        if (executed >= cycles)\n"
+        "            break;\n"
+        "        // Not translated, rewritten or over budget: interpret one instruction\n"
+        "        unsigned short opcode = chip8_FetchInstructionMem(&chip->memory, r->PC);\n"
+        "        chip8_Step(chip);\n"
+        "        executed++;\n"
+        "        if ((opcode & 0xf0ff) == 0xf033)\n"
+        "            chip8_AotCheck(chip, stale, r->I_Register, r->I_Register + 2);\n"
+        "        if ((opcode & 0xf0ff) == 0xf055)\n"
+        "            chip8_AotCheck(chip, stale, r->I_Register, r->I_Register + (opcode >> 8 & 0xf));\n"
+        "    }\n"
+        "    return executed;\n"
+        "}\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("[ERROR] usage: chip8aot <rom> <output.c>\n");
+        return -1;
+    }
+
+    rom = (const unsigned char *) chip8_ReadProgram(argv[1], &rom_size);
+    if (!rom) {
+        printf("[ERROR] failed to read %s \n", argv[1]);
+        return -1;
+    }
+    if (rom_size < 2 || CHIP8_PROGRAM_LOAD_ADDR + rom_size >= CHIP8_MEM_SIZE) {
+        printf("[ERROR] %s is empty or does not fit in memory \n", argv[1]);
+        return -1;
+    }
+
+    chip8_InitDispatch();
+    chip8_AotRecoverFlow();
+
+    FILE *out = fopen(argv[2], "w");
+    if (!out) {
+        printf("[ERROR] failed to open output file: %s \n", argv[2]);
+        return -1;
+    }
+    chip8_AotEmit(out, argv[1]);
+    fclose(out);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,321 @@
+#include "../include/chip8.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+//-----------------------------------------------------------------
+// CHIP8 BATCH RUNNER
+//-----------------------------------------------------------------
+// Runs many headless sessions across all cores. Each line of the session
+// list is
+//
+//     rom cycles [seed:n] [frame:+key | frame:-key ...]
+//
+// cycles is the instruction budget, seed picks the RND sequence (default
+// CHIP8_DEFAULT_SEED) and each input puts chip8 key 0-f down (+) or up (-)
+// at the start of the given 60 Hz frame. Inputs may be listed in any frame
+// order, inputs of the same frame apply in the order listed. Final registers and
+// framebuffers are printed in list order once every session finished,
+// a session stuck on Fx0A ends early and is reported as stalled.
+
+typedef struct chip8BatchInput {
+    long frame;
+    unsigned char key;
+    bool down;
+} chip8BatchInput;
+
+typedef struct chip8Session {
+    chip8 chip;
+    const char *rom;
+    long cycles;
+    unsigned long long seed;
+    long executed;
+    long frames;
+    // Fx0A is waiting and no key down is left to end the wait
+    bool stalled;
+    chip8BatchInput *inputs;    // sorted by frame
+    int input_count;
+    int input_capacity;
+} chip8Session;
+
+// Session indices [begin, end) packed as end << 32 | begin, the owner takes
+// from the front and thieves take half from the back, both by CAS. One
+// queue per cache line, so owners do not slow each other down.
+typedef struct chip8BatchQueue {
+    _Alignas(64) uint64_t range;
+} chip8BatchQueue;
+
+typedef struct chip8BatchPool {
+    chip8Session *sessions;
+    chip8BatchQueue *queues;
+    int workers;
+} chip8BatchPool;
+
+typedef struct chip8BatchWorker {
+    chip8BatchPool *pool;
+    int id;
+} chip8BatchWorker;
+
+static uint64_t chip8_BatchPack ( uint32_t begin, uint32_t end) {
+    return (uint64_t) end << 32 | begin;
+}
+
+// Each distinct ROM is loaded once, sessions fork their chip from it
+typedef struct chip8BatchRom {
+    const char *path;
+    chip8 chip;
+} chip8BatchRom;
+
+static chip8BatchRom *roms;
+static int rom_count, rom_capacity;
+
+//-----------------------------------------------------------------
+// CHIP8 BATCH SESSIONS
+//-----------------------------------------------------------------
+// Grows *array to hold at least count items, doubling the capacity
+static void chip8_BatchReserve ( void **array, int *capacity, int count, size_t item_size) {
+    if (count <= *capacity)
+        return;
+    *capacity = *capacity ? *capacity * 2 : 16;
+    *array = realloc(*array, *capacity * item_size);
+}
+
+// Returns the loaded ROM, reading it on first use, NULL when that fails
+static const chip8BatchRom * chip8_BatchRom ( const char *path) {
+    for (int i = 0; i < rom_count; i++) {
+        if (strcmp(roms[i].path, path) == 0)
+            return &roms[i];
+    }
+    long size;
+    const char *buff = chip8_ReadProgram((char *) path, &size);
+    if (!buff)
+        return NULL;
+    chip8_BatchReserve((void **) &roms, &rom_capacity, rom_count + 1, sizeof(chip8BatchRom));
+    chip8BatchRom *rom = &roms[rom_count++];
+    rom->path = strdup(path);
+    chip8_init(&rom->chip);
+    chip8_LoadProgram(&rom->chip, buff, size);
+    free((void *) buff);
+    return rom;
+}
+
+// True when an input from next on still puts a key down
+static bool chip8_BatchKeyDownLeft ( const chip8Session *s, int next) {
+    for (; next < s->input_count; next++) {
+        if (s->inputs[next].down)
+            return true;
+    }
+    return false;
+}
+
+static void chip8_BatchRunSession ( chip8Session *s) {
+    int next = 0;
+    while (s->executed < s->cycles) {
+        for (; next < s->input_count && s->inputs[next].frame <= s->frames; next++) {
+            if (s->inputs[next].down)
+                chip8_PutKeyDown(&s->chip.keyboard, s->inputs[next].key);
+            else
+                chip8_PutKeyUp(&s->chip.keyboard, s->inputs[next].key);
+        }
+        // only a key going down ends the wait, key ups left over cannot
+        if (s->chip.keyboard.waiting && !chip8_BatchKeyDownLeft(s, next)) {
+            s->stalled = true;
+            break;
+        }
+
+        long budget = s->cycles - s->executed;
+        if (budget > CHIP8_INSTRUCTIONS_PER_FRAME)
+            budget = CHIP8_INSTRUCTIONS_PER_FRAME;
+        s->executed += chip8_Run(&s->chip, budget);
+        chip8_TickTimers(&s->chip);
+        s->frames++;
+    }
+}
+
+// Parses one session list line, returns false on a malformed line
+static bool chip8_BatchParseSession ( chip8Session *s, char *line) {
+    char *rom = strtok(line, " \t\r\n");
+    char *cycles = strtok(NULL, " \t\r\n");
+    if (!rom || !cycles)
+        return false;
+    s->cycles = atol(cycles);
+    s->seed = CHIP8_DEFAULT_SEED;
+
+    char *token;
+    while ((token = strtok(NULL, " \t\r\n"))) {
+        if (strncmp(token, "seed:", 5) == 0) {
+            s->seed = strtoull(token + 5, NULL, 0);
+            continue;
+        }
+        long frame;
+        char sign;
+        unsigned int key;
+        if (sscanf(token, "%ld:%c%x", &frame, &sign, &key) != 3 || (sign != '+' && sign != '-') ||
+            key >= CHIP8_KEYBOARD_SIZE)
+            return false;
+        // insertion keeps the inputs sorted by frame and stable within one
+        chip8_BatchReserve((void **) &s->inputs, &s->input_capacity, s->input_count + 1,
+                           sizeof(chip8BatchInput));
+        int at = s->input_count++;
+        for (; at > 0 && s->inputs[at - 1].frame > frame; at--) {
+            s->inputs[at] = s->inputs[at - 1];
+        }
+        s->inputs[at] = (chip8BatchInput) { frame, key, sign == '+' };
+    }
+
+    // the fork shares the ROM's pages until the session writes to them
+    const chip8BatchRom *loaded = chip8_BatchRom(rom);
+    if (!loaded)
+        return false;
+    s->rom = loaded->path;
+    chip8_Fork(&s->chip, &loaded->chip);
+    chip8_Seed(&s->chip, s->seed);
+    return true;
+}
+
+static void chip8_BatchReport ( int id, const chip8Session *s) {
+    const chip8Registers *r = &s->chip.registers;
+    printf("session %d %s executed %ld frames %ld%s\n", id, s->rom, s->executed, s->frames,
+           s->stalled ? " stalled" : "");
+    printf("  PC=%03x I=%03x SP=%x DT=%02x ST=%02x V=", r->PC, r->I_Register, r->stackPointer,
+           r->delay_timer, r->sound_timer);
+    for (int i = 0; i < V_REGISTER_COUNT; i++) {
+        printf("%02x%s", r->V_Registers[i], i + 1 < V_REGISTER_COUNT ? " " : "\n");
+    }
+    for (int y = 0; y < WIN_HEIGHT; y++) {
+        printf("  %016llx\n", (unsigned long long) chip8_GetScreenRow(&s->chip.screen, y));
+    }
+}
+
+//-----------------------------------------------------------------
+// CHIP8 BATCH THREAD POOL
+//-----------------------------------------------------------------
+// Takes the front session of a queue, -1 when it is empty
+static long chip8_BatchTake ( chip8BatchQueue *q) {
+    uint64_t range = __atomic_load_n(&q->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t begin = (uint32_t) range, end = range >> 32;
+        if (begin >= end)
+            return -1;
+        if (__atomic_compare_exchange_n(&q->range, &range, chip8_BatchPack(begin + 1, end), true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return begin;
+    }
+}
+
+// Moves the back half of the victim's sessions into the thief's empty queue
+static bool chip8_BatchSteal ( chip8BatchQueue *victim, chip8BatchQueue *thief) {
+    uint64_t range = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t begin = (uint32_t) range, end = range >> 32;
+        if (begin >= end)
+            return false;
+        uint32_t half = (end - begin + 1) / 2;
+        if (__atomic_compare_exchange_n(&victim->range, &range, chip8_BatchPack(begin, end - half), true,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&thief->range, chip8_BatchPack(end - half, end), __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+}
+
+static void * chip8_BatchWork ( void *data) {
+    chip8BatchWorker *worker = data;
+    chip8BatchPool *pool = worker->pool;
+    chip8BatchQueue *own = &pool->queues[worker->id];
+
+    for (;;) {
+        long id = chip8_BatchTake(own);
+        if (id >= 0) {
+            chip8_BatchRunSession(&pool->sessions[id]);
+            continue;
+        }
+        // Sessions never spawn sessions, so once every queue is empty
+        // there is nothing left to steal
+        bool stolen = false;
+        for (int i = 1; i < pool->workers && !stolen; i++) {
+            stolen = chip8_BatchSteal(&pool->queues[(worker->id + i) % pool->workers], own);
+        }
+        if (!stolen)
+            return NULL;
+    }
+}
+
+static int chip8_BatchCpuCount ( void ) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+#endif
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("[ERROR] usage: chip8batch <session list> [threads]\n");
+        return -1;
+    }
+
+    FILE *list = fopen(argv[1], "r");
+    if (!list) {
+        printf("[ERROR] failed to open session list: %s \n", argv[1]);
+        return -1;
+    }
+
+    // Sessions are set up on this thread, chip8_init builds the shared
+    // dispatch tables before any worker runs
+    static char line[CHIP8_BATCH_LINE_MAX];
+    chip8Session *sessions = NULL;
+    int count = 0, capacity = 0, line_no = 0;
+    while (fgets(line, sizeof(line), list)) {
+        line_no++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#')
+            continue;
+        chip8_BatchReserve((void **) &sessions, &capacity, count + 1, sizeof(chip8Session));
+        memset(&sessions[count], 0, sizeof(chip8Session));
+        if (!chip8_BatchParseSession(&sessions[count], line)) {
+            printf("[ERROR] bad session on line %d of %s \n", line_no, argv[1]);
+            return -1;
+        }
+        count++;
+    }
+    fclose(list);
+
+    int workers = argc > 2 ? atoi(argv[2]) : chip8_BatchCpuCount();
+    if (workers < 1)
+        workers = 1;
+    if (workers > CHIP8_BATCH_MAX_THREADS)
+        workers = CHIP8_BATCH_MAX_THREADS;
+
+    // Sessions start spread evenly, stealing evens out uneven budgets
+    // static so every queue starts on its own cache line, calloc only
+    // promises 16-byte alignment
+    static chip8BatchQueue queues[CHIP8_BATCH_MAX_THREADS];
+    chip8BatchPool pool = { sessions, queues, workers };
+    chip8BatchWorker worker[CHIP8_BATCH_MAX_THREADS];
+    pthread_t threads[CHIP8_BATCH_MAX_THREADS];
+    for (int i = 0; i < workers; i++) {
+        pool.queues[i].range = chip8_BatchPack((long) count * i / workers, (long) count * (i + 1) / workers);
+        worker[i] = (chip8BatchWorker) { &pool, i };
+    }
+    for (int i = 1; i < workers; i++) {
+        pthread_create(&threads[i], NULL, chip8_BatchWork, &worker[i]);
+    }
+    chip8_BatchWork(&worker[0]);
+    for (int i = 1; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i = 0; i < count; i++) {
+        chip8_BatchReport(i, &sessions[i]);
+    }
+    return 0;
+}
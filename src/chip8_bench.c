@@ -0,0 +1,386 @@
+#include "../include/chip8.h"
+#include "../include/chip8_jit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+//-----------------------------------------------------------------
+// CHIP8 BENCHMARKS
+//-----------------------------------------------------------------
+// Times the core at three levels and prints one CSV row per benchmark:
+//
+//   op:<pattern>         ns per call of a single op handler
+//   draw:h<n>            ns per chip8_ScreenDrawSprite of an n row sprite
+//   rom:<name>:<core>    emulated MIPS of a whole ROM, headless, with a
+//                        fixed key script, on each interpreter core. A ROM
+//                        that halts on a jump to itself starts over.
+//
+//   chip8bench [-rom path ...] [-n iterations] [-cycles n] [-o out.csv]
+//              [-baseline old.csv] [-tolerance percent]
+//
+// With -baseline every row also gets the baseline value, the change in
+// percent and whether it regressed by more than the tolerance (default 10),
+// and the exit status is 1 when any did. Build with optimizations, e.g.
+// make bench FLAGS="-O2".
+
+// Calls per op and per sprite height, and timed repeats of which the fastest counts
+#define CHIP8_BENCH_ITERATIONS 10000000
+#define CHIP8_BENCH_REPEATS    5
+// Instructions run per ROM and core, and per emulated frame
+#define CHIP8_BENCH_ROM_CYCLES   50000000
+#define CHIP8_BENCH_FRAME_CYCLES 1000
+// The key script presses the next key every CHIP8_BENCH_KEY_FRAMES frames
+// and holds it for half of them
+#define CHIP8_BENCH_KEY_FRAMES 30
+#define CHIP8_BENCH_MAX_ROMS   64
+#define CHIP8_BENCH_MAX_ROWS   256
+
+// Where the handler benchmarks point PC and I, sprite data is loaded at I
+#define CHIP8_BENCH_PC 0x300
+#define CHIP8_BENCH_I  0x400
+
+typedef struct chip8BenchOp {
+    const char *name;
+    int count;
+    unsigned short opcodes[2];  // run in this order each iteration
+} chip8BenchOp;
+
+static const chip8BenchOp chip8_BenchOps[] = {
+    { "0nnn",      1, { 0x0000 } },
+    { "00E0",      1, { 0x00E0 } },
+    { "1nnn",      1, { 0x1300 } },
+    { "2nnn+00EE", 2, { 0x2300, 0x00EE } },
+    { "3xkk",      1, { 0x3012 } },
+    { "5xy0",      1, { 0x5010 } },
+    { "6xkk",      1, { 0x6012 } },
+    { "7xkk",      1, { 0x7001 } },
+    { "8xy0",      1, { 0x8010 } },
+    { "8xy2",      1, { 0x8012 } },
+    { "8xy4",      1, { 0x8014 } },
+    { "8xy5",      1, { 0x8015 } },
+    { "8xy6",      1, { 0x8016 } },
+    { "8xyE",      1, { 0x801E } },
+    { "Annn",      1, { 0xA400 } },
+    { "Bnnn",      1, { 0xB300 } },
+    { "Cxkk",      1, { 0xC0FF } },
+    { "Dxy5",      1, { 0xD015 } },
+    { "Dxyf",      1, { 0xD01F } },
+    { "Ex9E",      1, { 0xE09E } },
+    { "Fx07",      1, { 0xF007 } },
+    { "Fx15",      1, { 0xF015 } },
+    { "Fx1E",      1, { 0xF01E } },
+    { "Fx29",      1, { 0xF029 } },
+    { "Fx33",      1, { 0xF033 } },
+    { "Fx55",      1, { 0xFF55 } },
+    { "Fx65",      1, { 0xFF65 } },
+};
+
+// TANK moves on 2 4 6 8 and fires on 5
+static const unsigned char chip8_BenchKeys[] = { 0x2, 0x5, 0x6, 0x5, 0x8, 0x5, 0x4, 0x5 };
+
+typedef struct chip8BenchRow {
+    char name[96];
+    double value;
+} chip8BenchRow;
+
+static chip8BenchRow baseline[CHIP8_BENCH_MAX_ROWS];
+static int baseline_count;
+static double tolerance = 10;
+static bool compare;
+static bool regressed;
+static FILE *out_file;
+
+static long iterations = CHIP8_BENCH_ITERATIONS;
+static long rom_cycles = CHIP8_BENCH_ROM_CYCLES;
+
+static double chip8_BenchSeconds ( void ) {
+#ifdef _WIN32
+    // clock_gettime needs winpthreads, the performance counter is always there
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double) count.QuadPart / frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+//-----------------------------------------------------------------
+// CHIP8 BENCH REPORT
+//-----------------------------------------------------------------
+static bool chip8_BenchLoadBaseline ( const char *path) {
+    FILE *in = fopen(path, "r");
+    if (!in)
+        return false;
+    char line[256];
+    while (fgets(line, sizeof(line), in) && baseline_count < CHIP8_BENCH_MAX_ROWS) {
+        chip8BenchRow *row = &baseline[baseline_count];
+        char unit[32];
+        // the header and anything else without a number is skipped
+        if (sscanf(line, "%95[^,],%31[^,],%lf", row->name, unit, &row->value) == 3)
+            baseline_count++;
+    }
+    fclose(in);
+    return true;
+}
+
+// Rows go to stdout and, with -o, to the output file too
+static void chip8_BenchPrint ( const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    fflush(stdout);
+    if (out_file) {
+        va_start(args, fmt);
+        vfprintf(out_file, fmt, args);
+        va_end(args);
+    }
+}
+
+// Prints a row, higher is better for MIPS and worse for ns/op
+static void chip8_BenchReport ( const char *name, const char *unit, double value) {
+    if (!compare) {
+        chip8_BenchPrint("%s,%s,%.3f\n", name, unit, value);
+        return;
+    }
+    for (int i = 0; i < baseline_count; i++) {
+        if (strcmp(baseline[i].name, name) != 0)
+            continue;
+        double base = baseline[i].value;
+        double change = base != 0 ? (value - base) / base * 100 : 0;
+        bool worse = strcmp(unit, "MIPS") == 0 ? change < -tolerance : change > tolerance;
+        regressed |= worse;
+        chip8_BenchPrint("%s,%s,%.3f,%.3f,%+.1f,%s\n", name, unit, value, base, change,
+                         worse ? "regressed" : "ok");
+        return;
+    }
+    chip8_BenchPrint("%s,%s,%.3f,,,new\n", name, unit, value);
+}
+
+//-----------------------------------------------------------------
+// CHIP8 BENCH OPS AND SPRITES
+//-----------------------------------------------------------------
+static void chip8_BenchSetup ( chip8 *chip) {
+    // sprite rows at I, the rest of the program is zero
+    static char program[CHIP8_BENCH_I + CHIP8_SPRITE_MAX_ROWS - CHIP8_PROGRAM_LOAD_ADDR];
+    for (int i = 0; i < CHIP8_SPRITE_MAX_ROWS; i++) {
+        program[CHIP8_BENCH_I - CHIP8_PROGRAM_LOAD_ADDR + i] = 0x5a ^ (i * 0x11);
+    }
+    chip8_init(chip);
+    chip8_LoadProgram(chip, program, sizeof(program));
+    for (int r = 0; r < V_REGISTER_COUNT; r++) {
+        chip->registers.V_Registers[r] = r * 7 + 3;
+    }
+}
+
+static void chip8_BenchOp ( const chip8BenchOp *bench) {
+    static chip8 chip;
+    chip8_BenchSetup(&chip);
+
+    chip8Instruction ins[2];
+    chip8_OpHandler handlers[2];
+    int count = bench->count;
+    for (int k = 0; k < count; k++) {
+        chip8_DecodeInstruction(bench->opcodes[k], &ins[k]);
+        handlers[k] = chip8_GetHandler(ins[k].op);
+    }
+
+    chip8Registers *r = &chip.registers;
+    double best = 0;
+    for (int repeat = 0; repeat < CHIP8_BENCH_REPEATS; repeat++) {
+        double start = chip8_BenchSeconds();
+        for (long i = 0; i < iterations; i++) {
+            // every op starts from the same PC, I and stack
+            r->PC = CHIP8_BENCH_PC;
+            r->I_Register = CHIP8_BENCH_I;
+            r->stackPointer = 0;
+            for (int k = 0; k < count; k++) {
+                handlers[k](&chip, &ins[k]);
+            }
+        }
+        double seconds = chip8_BenchSeconds() - start;
+        if (repeat == 0 || seconds < best)
+            best = seconds;
+    }
+
+    char name[96];
+    snprintf(name, sizeof(name), "op:%s", bench->name);
+    chip8_BenchReport(name, "ns/op", best * 1e9 / ((double) iterations * count));
+    chip8_Release(&chip);
+}
+
+static void chip8_BenchDraw ( int height) {
+    static chip8 chip;
+    chip8_BenchSetup(&chip);
+    unsigned char scratch[CHIP8_SPRITE_MAX_ROWS];
+    const unsigned char *sprite = chip8_GetMemSpan(&chip.memory, CHIP8_BENCH_I, CHIP8_SPRITE_MAX_ROWS, scratch);
+
+    double best = 0;
+    for (int repeat = 0; repeat < CHIP8_BENCH_REPEATS; repeat++) {
+        double start = chip8_BenchSeconds();
+        for (long i = 0; i < iterations; i++) {
+            // walks every x so each shift and the wrap at the right edge are covered
+            chip8_ScreenDrawSprite(&chip.screen, i & (WIN_WIDTH - 1), (i >> 6) & (WIN_HEIGHT - 1),
+                                   (const char *) sprite, height);
+        }
+        double seconds = chip8_BenchSeconds() - start;
+        if (repeat == 0 || seconds < best)
+            best = seconds;
+    }
+
+    char name[96];
+    snprintf(name, sizeof(name), "draw:h%d", height);
+    chip8_BenchReport(name, "ns/op", best * 1e9 / iterations);
+    chip8_Release(&chip);
+}
+
+//-----------------------------------------------------------------
+// CHIP8 BENCH ROMS
+//-----------------------------------------------------------------
+static chip8Jit *bench_jit;
+
+static int chip8_BenchStepCore ( chip8 *chip, int cycles) {
+    for (int i = 0; i < cycles; i++) {
+        chip8_Step(chip);
+    }
+    return cycles;
+}
+
+static int chip8_BenchJitCore ( chip8 *chip, int cycles) {
+    return chip8_JitRun(bench_jit, chip, cycles);
+}
+
+static void chip8_BenchRom ( const char *path) {
+    static const struct {
+        const char *name;
+        int (*run) (chip8 *chip, int cycles);
+    } cores[] = {
+        { "step",     chip8_BenchStepCore },
+        { "run",      chip8_Run },
+        { "threaded", chip8_RunThreaded },
+        { "jit",      chip8_BenchJitCore },
+    };
+
+    long size;
+    const char *buff = chip8_ReadProgram((char *) path, &size);
+    if (!buff) {
+        fprintf(stderr, "[ERROR] failed to read %s \n", path);
+        return;
+    }
+    const char *base = strrchr(path, '/');
+    const char *base2 = strrchr(path, '\\');
+    if (base2 > base)
+        base = base2;
+    base = base ? base + 1 : path;
+
+    for (size_t c = 0; c < sizeof(cores) / sizeof(cores[0]); c++) {
+        if (cores[c].run == chip8_BenchJitCore && !bench_jit)
+            continue;
+        static chip8 chip;
+        chip8_init(&chip);
+        chip8_LoadProgram(&chip, buff, size);
+        if (cores[c].run == chip8_BenchJitCore)
+            chip8_JitFlush(bench_jit);
+        static unsigned char reset[CHIP8_STATE_SIZE];
+        chip8_SaveState(&chip, reset, sizeof(reset));
+
+        long executed = 0, frame = 0;
+        double start = chip8_BenchSeconds();
+        while (executed < rom_cycles) {
+            int key = chip8_BenchKeys[(frame / CHIP8_BENCH_KEY_FRAMES) % sizeof(chip8_BenchKeys)];
+            if (frame % CHIP8_BENCH_KEY_FRAMES == 0)
+                chip8_PutKeyDown(&chip.keyboard, key);
+            else if (frame % CHIP8_BENCH_KEY_FRAMES == CHIP8_BENCH_KEY_FRAMES / 2)
+                chip8_PutKeyUp(&chip.keyboard, key);
+
+            long budget = rom_cycles - executed;
+            executed += cores[c].run(&chip, budget < CHIP8_BENCH_FRAME_CYCLES ? budget : CHIP8_BENCH_FRAME_CYCLES);
+            chip8_TickTimers(&chip);
+            frame++;
+
+            // ROMs from chip8romgen halt on a jump to itself, they start
+            // over until the count is reached
+            unsigned short pc = chip.registers.PC;
+            if (pc + 1 < CHIP8_MEM_SIZE && chip8_FetchInstructionMem(&chip.memory, pc) == (0x1000 | pc))
+                chip8_LoadState(&chip, reset, sizeof(reset));
+        }
+        double seconds = chip8_BenchSeconds() - start;
+
+        char name[96];
+        snprintf(name, sizeof(name), "rom:%s:%s", base, cores[c].name);
+        chip8_BenchReport(name, "MIPS", executed / seconds / 1e6);
+        chip8_Release(&chip);
+    }
+    free((void *) buff);
+}
+
+//-----------------------------------------------------------------
+// CHIP8 BENCH MAIN
+//-----------------------------------------------------------------
+int main(int argc, char **argv) {
+    const char *roms[CHIP8_BENCH_MAX_ROMS];
+    int rom_count = 0;
+
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            printf("[ERROR] %s needs a value \n", argv[i]);
+            return -1;
+        }
+        const char *value = argv[i + 1];
+        if (strcmp(argv[i], "-rom") == 0 && rom_count < CHIP8_BENCH_MAX_ROMS) {
+            roms[rom_count++] = value;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            iterations = atol(value);
+        } else if (strcmp(argv[i], "-cycles") == 0) {
+            rom_cycles = atol(value);
+        } else if (strcmp(argv[i], "-tolerance") == 0) {
+            tolerance = atof(value);
+        } else if (strcmp(argv[i], "-baseline") == 0) {
+            if (!chip8_BenchLoadBaseline(value)) {
+                printf("[ERROR] failed to read baseline %s \n", value);
+                return -1;
+            }
+            compare = true;
+        } else if (strcmp(argv[i], "-o") == 0) {
+            out_file = fopen(value, "w");
+            if (!out_file) {
+                printf("[ERROR] failed to open output file: %s \n", value);
+                return -1;
+            }
+        } else {
+            printf("[ERROR] usage: chip8bench [-rom path ...] [-n iterations] [-cycles n] [-o out.csv] "
+                   "[-baseline old.csv] [-tolerance percent]\n");
+            return -1;
+        }
+    }
+    if (iterations <= 0 || rom_cycles <= 0) {
+        printf("[ERROR] -n and -cycles need a positive count \n");
+        return -1;
+    }
+
+    bench_jit = chip8_JitCreate();
+    chip8_BenchPrint(compare ? "benchmark,unit,value,baseline,change_pct,status\n" : "benchmark,unit,value\n");
+
+    for (size_t i = 0; i < sizeof(chip8_BenchOps) / sizeof(chip8_BenchOps[0]); i++) {
+        chip8_BenchOp(&chip8_BenchOps[i]);
+    }
+    for (int height = 1; height < CHIP8_SPRITE_MAX_ROWS; height++) {
+        chip8_BenchDraw(height);
+    }
+    for (int i = 0; i < rom_count; i++) {
+        chip8_BenchRom(roms[i]);
+    }
+
+    if (bench_jit)
+        chip8_JitDestroy(bench_jit);
+    if (out_file)
+        fclose(out_file);
+    return regressed ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+#include "../include/chip8.h"
+
+//-----------------------------------------------------------------
+// CHIP8 SPRITE BLITTERS
+//-----------------------------------------------------------------
+// Each blitter XORs num sprite rows into consecutive screen rows, the
+// caller splits draws that wrap past the bottom edge. Sprite bytes are
+// placed in the top byte of a row word and rotated right by shift.
+
+static bool chip8_BlitScalar ( uint64_t *rows, const unsigned char *sprite, int num, int shift) {
+    uint64_t collision = 0;
+    for (int i = 0; i < num; i++) {
+        uint64_t bits = (uint64_t) sprite[i] << (WIN_WIDTH - 8);
+        if (shift)
+            bits = (bits >> shift) | (bits << (WIN_WIDTH - shift));
+        collision |= rows[i] & bits;
+        rows[i] ^= bits;
+    }
+    return collision != 0;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+// Shift counts of 64 clear a lane, so shift = 0 needs no special case
+
+// Two rows per 128-bit vector
+__attribute__((target("sse2")))
+static bool chip8_BlitSSE2 ( uint64_t *rows, const unsigned char *sprite, int num, int shift) {
+    unsigned char bytes[CHIP8_SPRITE_MAX_ROWS] = { 0 };
+    memcpy(bytes, sprite, num);
+
+    // Widens byte i into the top byte of 64-bit lane i: 16 -> 32 -> 64 bits
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v   = _mm_loadu_si128((const __m128i *) bytes);
+    __m128i w16[2] = { _mm_unpacklo_epi8(zero, v), _mm_unpackhi_epi8(zero, v) };
+    __m128i bits[CHIP8_SPRITE_MAX_ROWS / 2];
+    for (int i = 0; i < 4; i++) {
+        __m128i w32 = i & 1 ? _mm_unpackhi_epi16(zero, w16[i >> 1]) : _mm_unpacklo_epi16(zero, w16[i >> 1]);
+        bits[2 * i]     = _mm_unpacklo_epi32(zero, w32);
+        bits[2 * i + 1] = _mm_unpackhi_epi32(zero, w32);
+    }
+
+    const __m128i right = _mm_cvtsi32_si128(shift);
+    const __m128i left  = _mm_cvtsi32_si128(WIN_WIDTH - shift);
+    __m128i collision = zero;
+    for (int i = 0; i < num; i += 2) {
+        __m128i b = _mm_or_si128(_mm_srl_epi64(bits[i >> 1], right), _mm_sll_epi64(bits[i >> 1], left));
+        __m128i *dst = (__m128i *) &rows[i];
+        if (i + 1 < num) {
+            __m128i screen = _mm_loadu_si128(dst);
+            collision = _mm_or_si128(collision, _mm_and_si128(screen, b));
+            _mm_storeu_si128(dst, _mm_xor_si128(screen, b));
+        } else {
+            // odd row count, only the low lane is on screen
+            __m128i screen = _mm_loadl_epi64(dst);
+            collision = _mm_or_si128(collision, _mm_and_si128(screen, b));
+            _mm_storel_epi64(dst, _mm_xor_si128(screen, b));
+        }
+    }
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(collision, zero)) != 0xffff;
+}
+
+// Four rows per 256-bit vector
+__attribute__((target("avx2")))
+static bool chip8_BlitAVX2 ( uint64_t *rows, const unsigned char *sprite, int num, int shift) {
+    unsigned char bytes[CHIP8_SPRITE_MAX_ROWS] = { 0 };
+    memcpy(bytes, sprite, num);
+
+    const __m128i right = _mm_cvtsi32_si128(shift);
+    const __m128i left  = _mm_cvtsi32_si128(WIN_WIDTH - shift);
+    __m256i collision = _mm256_setzero_si256();
+    for (int i = 0; i < num; i += 4) {
+        int quad;
+        memcpy(&quad, &bytes[i], sizeof(quad));
+        __m256i b = _mm256_slli_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(quad)), WIN_WIDTH - 8);
+        b = _mm256_or_si256(_mm256_srl_epi64(b, right), _mm256_sll_epi64(b, left));
+
+        long long *dst = (long long *) &rows[i];
+        if (i + 4 <= num) {
+            __m256i screen = _mm256_loadu_si256((const __m256i *) dst);
+            collision = _mm256_or_si256(collision, _mm256_and_si256(screen, b));
+            _mm256_storeu_si256((__m256i *) dst, _mm256_xor_si256(screen, b));
+        } else {
+            // lanes past num are neither read nor written
+            __m256i mask = _mm256_cmpgt_epi64(_mm256_set1_epi64x(num - i), _mm256_setr_epi64x(0, 1, 2, 3));
+            __m256i screen = _mm256_maskload_epi64(dst, mask);
+            collision = _mm256_or_si256(collision, _mm256_and_si256(screen, b));
+            _mm256_maskstore_epi64(dst, mask, _mm256_xor_si256(screen, b));
+        }
+    }
+    return !_mm256_testz_si256(collision, collision);
+}
+
+chip8_SpriteBlitter chip8_GetSpriteBlitter ( void ) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return chip8_BlitAVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return chip8_BlitSSE2;
+    return chip8_BlitScalar;
+}
+
+#else
+
+chip8_SpriteBlitter chip8_GetSpriteBlitter ( void ) {
+    return chip8_BlitScalar;
+}
+
+#endif
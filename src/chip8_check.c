@@ -0,0 +1,155 @@
+#include "../include/chip8.h"
+#include "../include/chip8_lockstep.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+//-----------------------------------------------------------------
+// CHIP8 LOCKSTEP CHECK
+//-----------------------------------------------------------------
+// Runs a ROM on chip8_LockstepRun and on one chip8_Run instance per lockstep
+// instance, then compares registers, stack, RAM and screen of every pair.
+// The AVX2 path is checked when the CPU has it, the scalar path always.
+//
+//   chip8check <rom> [-n instances] [-frames n] [-ipf n]
+//
+// Each instance gets its own RND seed and key presses, so instances leave
+// the shared PC at different times. Exits with 1 on the first mismatch.
+
+// Frames a key stays down, then as many up
+#define CHIP8_CHECK_KEY_FRAMES 8
+
+static int instances = 67;
+static long frames = 600;
+static int instructions_per_frame = CHIP8_INSTRUCTIONS_PER_FRAME;
+
+// Key presses of instance i at the start of a frame, the same for both runs
+static void chip8_CheckKeys ( chip8 *chip, int i, long frame) {
+    int key = (frame / (2 * CHIP8_CHECK_KEY_FRAMES) + i) % CHIP8_KEYBOARD_SIZE;
+    long phase = (frame + i) % (2 * CHIP8_CHECK_KEY_FRAMES);
+    if (phase == 0)
+        chip8_PutKeyDown(&chip->keyboard, key);
+    else if (phase == CHIP8_CHECK_KEY_FRAMES)
+        chip8_PutKeyUp(&chip->keyboard, key);
+}
+
+// Prints the first difference between a and b, returns false if there is one
+static bool chip8_CheckSame ( int i, chip8 *a, chip8 *b) {
+    const chip8Registers *ra = &a->registers, *rb = &b->registers;
+    for (int v = 0; v < V_REGISTER_COUNT; v++) {
+        if (ra->V_Registers[v] != rb->V_Registers[v]) {
+            printf("  instance %d: V%X %02x, chip8_Run has %02x \n", i, v, ra->V_Registers[v], rb->V_Registers[v]);
+            return false;
+        }
+    }
+    if (ra->I_Register != rb->I_Register || ra->PC != rb->PC || ra->stackPointer != rb->stackPointer ||
+        ra->delay_timer != rb->delay_timer || ra->sound_timer != rb->sound_timer) {
+        printf("  instance %d: PC=%03x I=%03x SP=%x DT=%02x ST=%02x, chip8_Run has PC=%03x I=%03x SP=%x DT=%02x ST=%02x \n",
+               i, ra->PC, ra->I_Register, ra->stackPointer, ra->delay_timer, ra->sound_timer,
+               rb->PC, rb->I_Register, rb->stackPointer, rb->delay_timer, rb->sound_timer);
+        return false;
+    }
+    if (memcmp(a->stack.stack, b->stack.stack, sizeof(a->stack.stack)) != 0) {
+        printf("  instance %d: stack differs \n", i);
+        return false;
+    }
+    for (int addr = 0; addr < CHIP8_MEM_SIZE; addr++) {
+        if (chip8_GetMem(&a->memory, addr) != chip8_GetMem(&b->memory, addr)) {
+            printf("  instance %d: RAM at %03x %02x, chip8_Run has %02x \n", i, addr,
+                   chip8_GetMem(&a->memory, addr), chip8_GetMem(&b->memory, addr));
+            return false;
+        }
+    }
+    for (int y = 0; y < WIN_HEIGHT; y++) {
+        if (chip8_GetScreenRow(&a->screen, y) != chip8_GetScreenRow(&b->screen, y)) {
+            printf("  instance %d: screen row %d differs \n", i, y);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs the ROM both ways with the AVX2 path on or off, returns true when every instance matches
+static bool chip8_CheckPath ( const char *buff, long size, bool simd) {
+    chip8Lockstep *ls = chip8_LockstepCreate(instances, buff, size);
+    chip8 *reference = calloc(instances, sizeof(chip8));
+    if (!ls || !reference) {
+        printf("[ERROR] out of memory for %d instances \n", instances);
+        exit(-1);
+    }
+    if (chip8_LockstepSetSimd(ls, simd) != simd) {
+        printf("avx2    skipped, the CPU does not support it \n");
+        chip8_LockstepDestroy(ls);
+        free(reference);
+        return true;
+    }
+
+    for (int i = 0; i < instances; i++) {
+        chip8_init(&reference[i]);
+        chip8_Seed(&reference[i], i);
+        chip8_LoadProgram(&reference[i], buff, size);
+        // RND runs on chip8_Step, which draws from the instance's own chip
+        chip8_Seed(chip8_LockstepGetChip(ls, i), i);
+    }
+
+    // chip8_Run stops at Fx0A while the lockstep instance repeats it until
+    // the frame ends, both pick up the key at the next frame
+    for (long frame = 0; frame < frames; frame++) {
+        for (int i = 0; i < instances; i++) {
+            chip8_CheckKeys(chip8_LockstepGetChip(ls, i), i, frame);
+            chip8_CheckKeys(&reference[i], i, frame);
+            chip8_Run(&reference[i], instructions_per_frame);
+            chip8_TickTimers(&reference[i]);
+        }
+        chip8_LockstepRun(ls, instructions_per_frame);
+        chip8_LockstepTickTimers(ls);
+    }
+
+    int mismatches = 0;
+    for (int i = 0; i < instances; i++) {
+        if (!chip8_CheckSame(i, chip8_LockstepGetChip(ls, i), &reference[i]))
+            mismatches++;
+        chip8_Release(&reference[i]);
+    }
+    printf("%-7s %d of %d instances match chip8_Run \n", simd ? "avx2" : "scalar",
+           instances - mismatches, instances);
+    chip8_LockstepDestroy(ls);
+    free(reference);
+    return mismatches == 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("[ERROR] usage: chip8check <rom> [-n instances] [-frames n] [-ipf n]\n");
+        return -1;
+    }
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            printf("[ERROR] %s needs a value \n", argv[i]);
+            return -1;
+        }
+        if (strcmp(argv[i], "-n") == 0) {
+            instances = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-frames") == 0) {
+            frames = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "-ipf") == 0) {
+            instructions_per_frame = atoi(argv[i + 1]);
+        } else {
+            printf("[ERROR] unknown option %s \n", argv[i]);
+            return -1;
+        }
+    }
+    if (instances < 1 || frames < 0 || instructions_per_frame < 1) {
+        printf("[ERROR] needs -n >= 1, -frames >= 0 and -ipf >= 1 \n");
+        return -1;
+    }
+
+    long size;
+    const char *buff = chip8_ReadProgram(argv[1], &size);
+    if (!buff)
+        return -1;
+    printf("%s \n", argv[1]);
+    bool same = chip8_CheckPath(buff, size, true);
+    same &= chip8_CheckPath(buff, size, false);
+    free((void *) buff);
+    return same ? 0 : 1;
+}
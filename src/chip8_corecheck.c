@@ -0,0 +1,126 @@
+#include "../include/chip8.h"
+#include "../include/chip8_jit.h"
+#include "../include/chip8_aot.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+//-----------------------------------------------------------------
+// CHIP8 CORE CHECK
+//-----------------------------------------------------------------
+// Runs a ROM on every core with the same seed, key presses and frames, then
+// compares each core's chip8_SaveState with chip8_Run's. Linked with the
+// chip8aot translation of the same ROM, see make check.
+//
+//   chip8corecheck <rom> [-frames n] [-ipf n]
+//
+// Exits with 1 when a core differs.
+
+// Frames a key stays down, then as many up
+#define CHIP8_CHECK_KEY_FRAMES 8
+
+static long frames = 2000;
+static int instructions_per_frame = 1000;
+static chip8Jit *jit;
+
+// Stops on an Fx0A wait like the other cores
+static int chip8_CheckStepCore ( chip8 *chip, int cycles) {
+    int executed = 0;
+    while (executed < cycles && !chip->keyboard.waiting) {
+        chip8_Step(chip);
+        executed++;
+    }
+    return executed;
+}
+
+static int chip8_CheckJitCore ( chip8 *chip, int cycles) {
+    return chip8_JitRun(jit, chip, cycles);
+}
+
+static const struct {
+    const char *name;
+    int (*run) (chip8 *chip, int cycles);
+} cores[] = {
+    { "run",      chip8_Run },
+    { "step",     chip8_CheckStepCore },
+    { "threaded", chip8_RunThreaded },
+    { "jit",      chip8_CheckJitCore },
+    { "aot",      chip8_AotRun },
+};
+
+// Runs the schedule on one core, leaves its state in state and returns the instructions run
+static long chip8_CheckCore ( int c, const char *buff, long size, unsigned char *state) {
+    static chip8 chip;
+    chip8_init(&chip);
+    chip8_Seed(&chip, 0x5eed);
+    chip8_LoadProgram(&chip, buff, size);
+    chip8_JitFlush(jit);
+
+    long executed = 0;
+    for (long frame = 0; frame < frames; frame++) {
+        int key = frame / (2 * CHIP8_CHECK_KEY_FRAMES) % CHIP8_KEYBOARD_SIZE;
+        if (frame % (2 * CHIP8_CHECK_KEY_FRAMES) == 0)
+            chip8_PutKeyDown(&chip.keyboard, key);
+        else if (frame % (2 * CHIP8_CHECK_KEY_FRAMES) == CHIP8_CHECK_KEY_FRAMES)
+            chip8_PutKeyUp(&chip.keyboard, key);
+        executed += cores[c].run(&chip, instructions_per_frame);
+        chip8_TickTimers(&chip);
+    }
+    chip8_SaveState(&chip, state, CHIP8_STATE_SIZE);
+    chip8_Release(&chip);
+    return executed;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("[ERROR] usage: chip8corecheck <rom> [-frames n] [-ipf n]\n");
+        return -1;
+    }
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            printf("[ERROR] %s needs a value \n", argv[i]);
+            return -1;
+        }
+        if (strcmp(argv[i], "-frames") == 0) {
+            frames = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "-ipf") == 0) {
+            instructions_per_frame = atoi(argv[i + 1]);
+        } else {
+            printf("[ERROR] unknown option %s \n", argv[i]);
+            return -1;
+        }
+    }
+    if (frames < 0 || instructions_per_frame < 1) {
+        printf("[ERROR] needs -frames >= 0 and -ipf >= 1 \n");
+        return -1;
+    }
+
+    long size;
+    const char *buff = chip8_ReadProgram(argv[1], &size);
+    if (!buff)
+        return -1;
+    // NULL without executable memory, the jit row then checks chip8_Run again
+    jit = chip8_JitCreate();
+
+    static unsigned char expected[CHIP8_STATE_SIZE], state[CHIP8_STATE_SIZE];
+    long expected_executed = chip8_CheckCore(0, buff, size, expected);
+    bool same = true;
+    printf("%s \n", argv[1]);
+    for (size_t c = 1; c < sizeof(cores) / sizeof(cores[0]); c++) {
+        long executed = chip8_CheckCore(c, buff, size, state);
+        size_t at = 0;
+        while (at < CHIP8_STATE_SIZE && state[at] == expected[at])
+            at++;
+        if (executed != expected_executed) {
+            printf("%-9s ran %ld instructions, chip8_Run ran %ld \n", cores[c].name, executed, expected_executed);
+            same = false;
+        } else if (at < CHIP8_STATE_SIZE) {
+            printf("%-9s state differs from chip8_Run at byte %zu of the savestate \n", cores[c].name, at);
+            same = false;
+        } else {
+            printf("%-9s matches chip8_Run after %ld instructions \n", cores[c].name, executed);
+        }
+    }
+    chip8_JitDestroy(jit);
+    free((void *) buff);
+    return same ? 0 : 1;
+}
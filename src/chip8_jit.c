@@ -0,0 +1,406 @@
+#include "../include/chip8_jit.h"
+#include "../include/chip8_trace.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+//-----------------------------------------------------------------
+// CHIP8 JIT STATE
+//-----------------------------------------------------------------
+// A translated block takes the chip and returns the instructions it ran
+typedef int (*chip8_JitBlock)( chip8 *chip);
+
+struct chip8Jit {
+    unsigned char *code;
+    size_t used;
+    // chip, decode cache and code generation the translations were made
+    // for; translated code points into the cache slots
+    chip8 *chip;
+    const chip8Instruction *decoded;
+    unsigned int generation;
+    chip8_JitBlock entry[CHIP8_MEM_SIZE / 2];
+    unsigned char len[CHIP8_MEM_SIZE / 2];
+    unsigned char heat[CHIP8_MEM_SIZE / 2];
+};
+
+// Worst case bytes emitted for one instruction, prologue or epilogue
+#define CHIP8_JIT_MAX_INSN_SIZE 64
+
+//-----------------------------------------------------------------
+// CHIP8 JIT EMITTER
+//-----------------------------------------------------------------
+// Register use inside a translated block:
+//   rbx - chip pointer, every V register is a byte at [rbx + disp32]
+//   r12 - I_Register, written back before helper calls and on exit
+// PC is a compile time constant inside a block and is stored once on
+// entry; jumps and skips overwrite it.
+typedef struct chip8Emitter {
+    unsigned char *p;
+} chip8Emitter;
+
+static void emit8 ( chip8Emitter *e, uint8_t v) {
+    *e->p++ = v;
+}
+static void emit16 ( chip8Emitter *e, uint16_t v) {
+    memcpy(e->p, &v, 2);
+    e->p += 2;
+}
+static void emit32 ( chip8Emitter *e, uint32_t v) {
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+static void emit64 ( chip8Emitter *e, uint64_t v) {
+    memcpy(e->p, &v, 8);
+    e->p += 8;
+}
+
+// ModRM for [rbx + disp32] with reg field r, followed by the displacement
+static void emitMem ( chip8Emitter *e, int r, size_t disp) {
+    emit8(e, 0x80 | (r << 3) | 3);
+    emit32(e, (uint32_t) disp);
+}
+
+// Register numbers used in the reg field of emitMem
+#define REG_AL 0
+#define REG_CL 1
+
+#define OFF_V(r)  (offsetof(chip8, registers.V_Registers) + (r))
+#define OFF_I     offsetof(chip8, registers.I_Register)
+#define OFF_PC    offsetof(chip8, registers.PC)
+#define OFF_DT    offsetof(chip8, registers.delay_timer)
+#define OFF_ST    offsetof(chip8, registers.sound_timer)
+
+#ifdef _WIN32
+// rcx holds the first argument, 32 bytes of shadow space for callees
+#define FRAME_SIZE 40
+#else
+#define FRAME_SIZE 8
+#endif
+
+static void emitPrologue ( chip8Emitter *e) {
+    emit8(e, 0x53);                                 // push rbx
+    emit8(e, 0x41); emit8(e, 0x54);                 // push r12
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xEC); // sub rsp, FRAME_SIZE
+    emit8(e, FRAME_SIZE);
+#ifdef _WIN32
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xCB); // mov rbx, rcx
+#else
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xFB); // mov rbx, rdi
+#endif
+    emit8(e, 0x44); emit8(e, 0x0F); emit8(e, 0xB7); // movzx r12d, word [I]
+    emitMem(e, 4, OFF_I);
+}
+
+static void emitStoreI ( chip8Emitter *e) {
+    emit8(e, 0x66); emit8(e, 0x44); emit8(e, 0x89); // mov word [I], r12w
+    emitMem(e, 4, OFF_I);
+}
+
+static void emitStorePC ( chip8Emitter *e, unsigned short pc) {
+    emit8(e, 0x66); emit8(e, 0xC7);                 // mov word [PC], imm16
+    emitMem(e, 0, OFF_PC);
+    emit16(e, pc);
+}
+
+static void emitEpilogue ( chip8Emitter *e, int count) {
+    emitStoreI(e);
+    emit8(e, 0xB8); emit32(e, count);               // mov eax, count
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC4); // add rsp, FRAME_SIZE
+    emit8(e, FRAME_SIZE);
+    emit8(e, 0x41); emit8(e, 0x5C);                 // pop r12
+    emit8(e, 0x5B);                                 // pop rbx
+    emit8(e, 0xC3);                                 // ret
+}
+
+// mov reg8, byte [off] / mov byte [off], reg8
+static void emitLoad8 ( chip8Emitter *e, int r, size_t off) {
+    emit8(e, 0x8A);
+    emitMem(e, r, off);
+}
+static void emitStore8 ( chip8Emitter *e, int r, size_t off) {
+    emit8(e, 0x88);
+    emitMem(e, r, off);
+}
+
+// Calls the interpreter handler for ins
+static void emitHelper ( chip8Emitter *e, const chip8Instruction *ins) {
+    emitStoreI(e);
+#ifdef _WIN32
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xD9); // mov rcx, rbx
+    emit8(e, 0x48); emit8(e, 0xBA);                 // mov rdx, ins
+#else
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF); // mov rdi, rbx
+    emit8(e, 0x48); emit8(e, 0xBE);                 // mov rsi, ins
+#endif
+    emit64(e, (uint64_t) (uintptr_t) ins);
+    emit8(e, 0x48); emit8(e, 0xB8);                 // mov rax, handler
+    emit64(e, (uint64_t) (uintptr_t) chip8_GetHandler(ins->op));
+    emit8(e, 0xFF); emit8(e, 0xD0);                 // call rax
+}
+
+// PC = condition ? next + 2 : next, where the flags were just set by a compare.
+// cmov is 0x44 for equal, 0x45 for not equal.
+static void emitSkip ( chip8Emitter *e, uint8_t cmov, unsigned short next) {
+    emit8(e, 0xB8); emit32(e, next);                // mov eax, next
+    emit8(e, 0xB9); emit32(e, next + 2);            // mov ecx, next + 2
+    emit8(e, 0x0F); emit8(e, cmov); emit8(e, 0xC1); // cmovcc eax, ecx
+    emit8(e, 0x66); emit8(e, 0x89);                 // mov word [PC], ax
+    emitMem(e, REG_AL, OFF_PC);
+}
+
+// Emits one instruction, next is the address right after it
+static void emitInstruction ( chip8Emitter *e, const chip8Instruction *ins, unsigned short next) {
+    int x = ins->x;
+    int y = ins->y;
+
+    switch (ins->op) {
+        case CHIP8_OP_NOP :
+            break;
+        case CHIP8_OP_JP :
+            emitStorePC(e, ins->nnn);
+            break;
+        case CHIP8_OP_SE_VX_KK :
+        case CHIP8_OP_SNE_VX_KK :
+            emit8(e, 0x80); emitMem(e, 7, OFF_V(x));    // cmp byte [Vx], kk
+            emit8(e, ins->kk);
+            emitSkip(e, ins->op == CHIP8_OP_SE_VX_KK ? 0x44 : 0x45, next);
+            break;
+        case CHIP8_OP_SE_VX_VY :
+        case CHIP8_OP_SNE_VX_VY :
+            emitLoad8(e, REG_AL, OFF_V(x));
+            emit8(e, 0x3A); emitMem(e, REG_AL, OFF_V(y)); // cmp al, [Vy]
+            emitSkip(e, ins->op == CHIP8_OP_SE_VX_VY ? 0x44 : 0x45, next);
+            break;
+        case CHIP8_OP_LD_VX_KK :
+            emit8(e, 0xC6); emitMem(e, 0, OFF_V(x));    // mov byte [Vx], kk
+            emit8(e, ins->kk);
+            break;
+        case CHIP8_OP_ADD_VX_KK :
+            emit8(e, 0x80); emitMem(e, 0, OFF_V(x));    // add byte [Vx], kk
+            emit8(e, ins->kk);
+            break;
+        case CHIP8_OP_LD_VX_VY :
+            emitLoad8(e, REG_AL, OFF_V(y));
+            emitStore8(e, REG_AL, OFF_V(x));
+            break;
+        case CHIP8_OP_OR :
+        case CHIP8_OP_AND :
+        case CHIP8_OP_XOR :
+            emitLoad8(e, REG_AL, OFF_V(y));
+            emit8(e, ins->op == CHIP8_OP_OR ? 0x08 : ins->op == CHIP8_OP_AND ? 0x20 : 0x30);
+            emitMem(e, REG_AL, OFF_V(x));               // op [Vx], al
+            break;
+        case CHIP8_OP_ADD_VX_VY :
+            emitLoad8(e, REG_AL, OFF_V(x));
+            emit8(e, 0x02); emitMem(e, REG_AL, OFF_V(y)); // add al, [Vy]
+            emit8(e, 0x0F); emit8(e, 0x92); emit8(e, 0xC1); // setc cl
+            emitStore8(e, REG_CL, OFF_V(0x0f));
+            emitStore8(e, REG_AL, OFF_V(x));
+            break;
+        // SUB and SUBN reload their operands after VF is written, as the
+        // interpreter does, so x or y = F behaves the same
+        case CHIP8_OP_SUB :
+        case CHIP8_OP_SUBN :
+        {
+            int a = ins->op == CHIP8_OP_SUB ? x : y;
+            int b = ins->op == CHIP8_OP_SUB ? y : x;
+            if (ins->op == CHIP8_OP_SUB) {
+                emit8(e, 0xC6); emitMem(e, 0, OFF_V(0x0f)); // mov byte [VF], 0
+                emit8(e, 0);
+            }
+            emitLoad8(e, REG_AL, OFF_V(a));
+            emit8(e, 0x3A); emitMem(e, REG_AL, OFF_V(b)); // cmp al, [Vb]
+            emit8(e, 0x0F); emit8(e, 0x97); emit8(e, 0xC1); // seta cl
+            emitStore8(e, REG_CL, OFF_V(0x0f));
+            emitLoad8(e, REG_AL, OFF_V(a));
+            emit8(e, 0x2A); emitMem(e, REG_AL, OFF_V(b)); // sub al, [Vb]
+            emitStore8(e, REG_AL, OFF_V(x));
+        }
+            break;
+        case CHIP8_OP_SHR :
+        case CHIP8_OP_SHL :
+            emitLoad8(e, REG_AL, OFF_V(x));
+            emit8(e, 0x24);                             // and al, mask
+            emit8(e, ins->op == CHIP8_OP_SHR ? 0x01 : 0x80);
+            emitStore8(e, REG_AL, OFF_V(0x0f));
+            emit8(e, 0xD0);                             // shr/shl byte [Vx], 1
+            emitMem(e, ins->op == CHIP8_OP_SHR ? 5 : 4, OFF_V(x));
+            break;
+        case CHIP8_OP_LD_I :
+            emit8(e, 0x41); emit8(e, 0xBC); emit32(e, ins->nnn); // mov r12d, nnn
+            break;
+        case CHIP8_OP_ADD_I_VX :
+            emit8(e, 0x0F); emit8(e, 0xB6); emitMem(e, REG_AL, OFF_V(x)); // movzx eax, byte [Vx]
+            emit8(e, 0x66); emit8(e, 0x41); emit8(e, 0x01); emit8(e, 0xC4); // add r12w, ax
+            break;
+        case CHIP8_OP_LD_F_VX :
+            emit8(e, 0x0F); emit8(e, 0xB6); emitMem(e, REG_AL, OFF_V(x)); // movzx eax, byte [Vx]
+            emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0x80); // lea eax, [rax + rax * 4]
+            emit8(e, 0x41); emit8(e, 0x89); emit8(e, 0xC4); // mov r12d, eax
+            break;
+        case CHIP8_OP_LD_VX_DT :
+            emitLoad8(e, REG_AL, OFF_DT);
+            emitStore8(e, REG_AL, OFF_V(x));
+            break;
+        case CHIP8_OP_LD_DT_VX :
+            emitLoad8(e, REG_AL, OFF_V(x));
+            emitStore8(e, REG_AL, OFF_DT);
+            break;
+        case CHIP8_OP_LD_ST_VX :
+            emitLoad8(e, REG_AL, OFF_V(x));
+            emitStore8(e, REG_AL, OFF_ST);
+            break;
+        // Everything else goes through the interpreter handler
+        default :
+            emitHelper(e, ins);
+            break;
+    }
+}
+
+//-----------------------------------------------------------------
+// CHIP8 JIT FUNCTIONS
+//-----------------------------------------------------------------
+chip8Jit * chip8_JitCreate ( void ) {
+    chip8Jit *jit = calloc(1, sizeof(chip8Jit));
+    if (!jit)
+        return NULL;
+#ifdef _WIN32
+    jit->code = VirtualAlloc(NULL, CHIP8_JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+    jit->code = mmap(NULL, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+        jit->code = NULL;
+#endif
+    if (!jit->code) {
+        free(jit);
+        return NULL;
+    }
+    return jit;
+}
+
+void chip8_JitDestroy ( chip8Jit *jit) {
+    if (!jit)
+        return;
+#ifdef _WIN32
+    VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+    munmap(jit->code, CHIP8_JIT_CODE_SIZE);
+#endif
+    free(jit);
+}
+
+void chip8_JitFlush ( chip8Jit *jit) {
+    if (!jit)
+        return;
+    jit->used = 0;
+    memset(jit->entry, 0, sizeof(jit->entry));
+    memset(jit->heat, 0, sizeof(jit->heat));
+}
+
+// Translates the block at an even pc, returns NULL when out of code space
+static chip8_JitBlock chip8_JitCompile ( chip8Jit *jit, chip8 *chip, unsigned short pc) {
+    const chip8Instruction *ins = chip8_GetBlock(&chip->memory, pc);
+    int len = ins->block_len;
+    // A skip fused with the jump after it is only a pair in the
+    // interpreter; the translation stops at the skip
+    if (len > 1 && chip8_IsBlockEnd(ins[len - 2].op))
+        len--;
+
+    if (jit->used + (len + 2) * CHIP8_JIT_MAX_INSN_SIZE > CHIP8_JIT_CODE_SIZE)
+        return NULL;
+
+    chip8Emitter e = { jit->code + jit->used };
+    unsigned char *start = e.p;
+    emitPrologue(&e);
+    // Same as chip8_ExecuteBlock: only the last instruction reads or
+    // moves PC, so PC is stored once up front
+    emitStorePC(&e, pc + 2 * len);
+    for (int i = 0; i < len; i++) {
+        emitInstruction(&e, &ins[i], pc + 2 * (i + 1));
+    }
+    emitEpilogue(&e, len);
+
+    jit->used = e.p - jit->code;
+    jit->entry[pc >> 1] = (chip8_JitBlock) start;
+    jit->len[pc >> 1]   = len;
+    return (chip8_JitBlock) start;
+}
+
+int chip8_JitRun ( chip8Jit *jit, chip8 *chip, int cycles) {
+    // chip8_JitCreate failed, no executable memory
+    if (!jit)
+        return chip8_Run(chip, cycles);
+#ifdef CHIP8_TRACE
+    // compiled blocks cannot report their instructions one by one
+    if (chip->trace)
+        return chip8_Run(chip, cycles);
+#endif
+    const chip8Instruction *decoded = chip8_GetDecoded(&chip->memory);
+    if (jit->chip != chip || jit->decoded != decoded || jit->generation != chip->memory.code_generation) {
+        chip8_JitFlush(jit);
+        jit->chip = chip;
+        jit->decoded = decoded;
+        jit->generation = chip->memory.code_generation;
+    }
+
+    int executed = 0;
+    while (executed < cycles && !chip->keyboard.waiting) {
+        unsigned short pc = chip->registers.PC;
+        int slot = pc >> 1;
+        chip8_JitBlock block = NULL;
+
+        if (!(pc & 1) && pc + 1 < CHIP8_MEM_SIZE) {
+            block = jit->entry[slot];
+            if (!block && ++jit->heat[slot] >= CHIP8_JIT_HOT_THRESHOLD) {
+                block = chip8_JitCompile(jit, chip, pc);
+                if (!block) {
+                    // code buffer is full, start over
+                    chip8_JitFlush(jit);
+                }
+            }
+        }
+
+        if (block && jit->len[slot] <= cycles - executed)
+            executed += block(chip);
+        else
+            executed += chip8_ExecuteBlock(chip, cycles - executed);
+
+        // a write hit translated code
+        if (jit->generation != chip->memory.code_generation) {
+            chip8_JitFlush(jit);
+            jit->generation = chip->memory.code_generation;
+        }
+    }
+    return executed;
+}
+
+#else
+
+//-----------------------------------------------------------------
+// CHIP8 JIT FUNCTIONS (unsupported host)
+//-----------------------------------------------------------------
+chip8Jit * chip8_JitCreate ( void ) {
+    return NULL;
+}
+
+void chip8_JitDestroy ( chip8Jit *jit) {
+    (void) jit;
+}
+
+void chip8_JitFlush ( chip8Jit *jit) {
+    (void) jit;
+}
+
+int chip8_JitRun ( chip8Jit *jit, chip8 *chip, int cycles) {
+    (void) jit;
+    return chip8_Run(chip, cycles);
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,393 @@
+#include "../include/chip8_lockstep.h"
+#include <stdlib.h>
+#include <assert.h>
+
+// Instances per chunk, one byte lane each in a 256-bit vector
+#define CHIP8_LOCKSTEP_LANES 32
+
+struct chip8Lockstep {
+    int count;
+    int lanes;                  // count rounded up to whole chunks
+    chip8 *chips;
+    // SoA registers, V register r of instance i is V[r * lanes + i]
+    unsigned char *V;
+    unsigned short *I;
+    unsigned short *PC;
+    unsigned char *DT;
+    unsigned char *ST;
+    bool simd;
+};
+
+//-----------------------------------------------------------------
+// CHIP8 LOCKSTEP SCALAR PATH
+//-----------------------------------------------------------------
+static void chip8_LockstepLoad ( chip8Lockstep *ls, int i) {
+    chip8Registers *r = &ls->chips[i].registers;
+    for (int v = 0; v < V_REGISTER_COUNT; v++) {
+        r->V_Registers[v] = ls->V[v * ls->lanes + i];
+    }
+    r->I_Register  = ls->I[i];
+    r->PC          = ls->PC[i];
+    r->delay_timer = ls->DT[i];
+    r->sound_timer = ls->ST[i];
+}
+
+static void chip8_LockstepStore ( chip8Lockstep *ls, int i) {
+    const chip8Registers *r = &ls->chips[i].registers;
+    for (int v = 0; v < V_REGISTER_COUNT; v++) {
+        ls->V[v * ls->lanes + i] = r->V_Registers[v];
+    }
+    ls->I[i]  = r->I_Register;
+    ls->PC[i] = r->PC;
+    ls->DT[i] = r->delay_timer;
+    ls->ST[i] = r->sound_timer;
+}
+
+// Runs one instruction of instance i on the interpreter
+static void chip8_LockstepStep ( chip8Lockstep *ls, int i) {
+    chip8_LockstepLoad(ls, i);
+    chip8_Step(&ls->chips[i]);
+    chip8_LockstepStore(ls, i);
+}
+
+static void chip8_LockstepRunScalar ( chip8Lockstep *ls, int base, int end, int cycles) {
+    for (int i = base; i < end; i++) {
+        for (int c = 0; c < cycles; c++) {
+            chip8_LockstepStep(ls, i);
+        }
+    }
+}
+
+// Ops the vector path runs, everything else goes through chip8_Step
+static bool chip8_LockstepIsVectorOp ( unsigned char op) {
+    switch (op) {
+        case CHIP8_OP_NOP :
+        case CHIP8_OP_JP :
+        case CHIP8_OP_SE_VX_KK :
+        case CHIP8_OP_SNE_VX_KK :
+        case CHIP8_OP_SE_VX_VY :
+        case CHIP8_OP_LD_VX_KK :
+        case CHIP8_OP_ADD_VX_KK :
+        case CHIP8_OP_LD_VX_VY :
+        case CHIP8_OP_OR :
+        case CHIP8_OP_AND :
+        case CHIP8_OP_XOR :
+        case CHIP8_OP_ADD_VX_VY :
+        case CHIP8_OP_SUB :
+        case CHIP8_OP_SHR :
+        case CHIP8_OP_SUBN :
+        case CHIP8_OP_SHL :
+        case CHIP8_OP_SNE_VX_VY :
+        case CHIP8_OP_LD_I :
+        case CHIP8_OP_JP_V0 :
+        case CHIP8_OP_LD_VX_DT :
+        case CHIP8_OP_LD_DT_VX :
+        case CHIP8_OP_LD_ST_VX :
+        case CHIP8_OP_ADD_I_VX :
+        case CHIP8_OP_LD_F_VX :
+            return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------
+// CHIP8 LOCKSTEP VECTOR PATH
+//-----------------------------------------------------------------
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+#define CHIP8_AVX2 __attribute__((target("avx2")))
+
+// Byte lane i of the result is all ones when bit i of mask is set
+CHIP8_AVX2 static inline __m256i chip8_LaneMask ( uint32_t mask) {
+    const __m256i select = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bits = _mm256_set1_epi64x(0x8040201008040201);
+    __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(mask), select);
+    return _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+}
+
+// Widens byte lanes 16 * half .. 16 * half + 15 to 16-bit lanes
+CHIP8_AVX2 static inline __m256i chip8_Widen ( __m256i v, int half, bool sign) {
+    __m128i h = half ? _mm256_extracti128_si256(v, 1) : _mm256_castsi256_si128(v);
+    return sign ? _mm256_cvtepi8_epi16(h) : _mm256_cvtepu8_epi16(h);
+}
+
+CHIP8_AVX2 static inline __m256i chip8_Load ( const void *p) {
+    return _mm256_loadu_si256((const __m256i *) p);
+}
+
+// Stores val into the lanes selected by mask
+CHIP8_AVX2 static inline void chip8_Store ( void *p, __m256i val, __m256i mask) {
+    _mm256_storeu_si256((__m256i *) p, _mm256_blendv_epi8(chip8_Load(p), val, mask));
+}
+
+// Unsigned a > b per byte lane
+CHIP8_AVX2 static inline __m256i chip8_Greater ( __m256i a, __m256i b) {
+    return _mm256_andnot_si256(_mm256_cmpeq_epi8(a, b), _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a));
+}
+
+// Lanes of the chunk whose PC is pc
+CHIP8_AVX2 static uint32_t chip8_LockstepSamePC ( chip8Lockstep *ls, int base, unsigned short pc) {
+    __m256i want = _mm256_set1_epi16(pc);
+    __m256i lo = _mm256_cmpeq_epi16(chip8_Load(&ls->PC[base]), want);
+    __m256i hi = _mm256_cmpeq_epi16(chip8_Load(&ls->PC[base + 16]), want);
+    // packs interleaves the 128-bit halves, the permute puts lanes back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xd8);
+    return (uint32_t) _mm256_movemask_epi8(packed);
+}
+
+// Runs ins on the lanes of the chip at base selected by lanes. Each store
+// reloads its operands, so x or y = F behave as in the interpreter.
+CHIP8_AVX2 static void chip8_LockstepVector ( chip8Lockstep *ls, int base, uint32_t lanes, const chip8Instruction *ins) {
+    const __m256i m    = chip8_LaneMask(lanes);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one  = _mm256_set1_epi8(1);
+    unsigned char *Vx = &ls->V[ins->x * ls->lanes + base];
+    unsigned char *Vy = &ls->V[ins->y * ls->lanes + base];
+    unsigned char *VF = &ls->V[0x0f * ls->lanes + base];
+    unsigned char *V0 = &ls->V[base];
+    __m256i skip = zero;
+    __m256i a, b;
+
+    switch (ins->op) {
+        case CHIP8_OP_SE_VX_KK :
+            skip = _mm256_cmpeq_epi8(chip8_Load(Vx), _mm256_set1_epi8(ins->kk));
+            break;
+        case CHIP8_OP_SNE_VX_KK :
+            skip = _mm256_xor_si256(_mm256_cmpeq_epi8(chip8_Load(Vx), _mm256_set1_epi8(ins->kk)), _mm256_set1_epi8(-1));
+            break;
+        case CHIP8_OP_SE_VX_VY :
+            skip = _mm256_cmpeq_epi8(chip8_Load(Vx), chip8_Load(Vy));
+            break;
+        case CHIP8_OP_SNE_VX_VY :
+            skip = _mm256_xor_si256(_mm256_cmpeq_epi8(chip8_Load(Vx), chip8_Load(Vy)), _mm256_set1_epi8(-1));
+            break;
+        case CHIP8_OP_LD_VX_KK :
+            chip8_Store(Vx, _mm256_set1_epi8(ins->kk), m);
+            break;
+        case CHIP8_OP_ADD_VX_KK :
+            chip8_Store(Vx, _mm256_add_epi8(chip8_Load(Vx), _mm256_set1_epi8(ins->kk)), m);
+            break;
+        case CHIP8_OP_LD_VX_VY :
+            chip8_Store(Vx, chip8_Load(Vy), m);
+            break;
+        case CHIP8_OP_OR :
+            chip8_Store(Vx, _mm256_or_si256(chip8_Load(Vx), chip8_Load(Vy)), m);
+            break;
+        case CHIP8_OP_AND :
+            chip8_Store(Vx, _mm256_and_si256(chip8_Load(Vx), chip8_Load(Vy)), m);
+            break;
+        case CHIP8_OP_XOR :
+            chip8_Store(Vx, _mm256_xor_si256(chip8_Load(Vx), chip8_Load(Vy)), m);
+            break;
+        case CHIP8_OP_ADD_VX_VY :
+        {
+            a = chip8_Load(Vx);
+            __m256i sum = _mm256_add_epi8(a, chip8_Load(Vy));
+            // carried when the sum wrapped below Vx
+            __m256i no_carry = _mm256_cmpeq_epi8(_mm256_max_epu8(sum, a), sum);
+            chip8_Store(VF, _mm256_andnot_si256(no_carry, one), m);
+            chip8_Store(Vx, sum, m);
+        }
+            break;
+        case CHIP8_OP_SUB :
+            chip8_Store(VF, zero, m);
+            chip8_Store(VF, _mm256_and_si256(chip8_Greater(chip8_Load(Vx), chip8_Load(Vy)), one), m);
+            chip8_Store(Vx, _mm256_sub_epi8(chip8_Load(Vx), chip8_Load(Vy)), m);
+            break;
+        case CHIP8_OP_SHR :
+            chip8_Store(VF, _mm256_and_si256(chip8_Load(Vx), one), m);
+            a = chip8_Load(Vx);
+            chip8_Store(Vx, _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7f)), m);
+            break;
+        case CHIP8_OP_SUBN :
+            chip8_Store(VF, _mm256_and_si256(chip8_Greater(chip8_Load(Vy), chip8_Load(Vx)), one), m);
+            chip8_Store(Vx, _mm256_sub_epi8(chip8_Load(Vy), chip8_Load(Vx)), m);
+            break;
+        case CHIP8_OP_SHL :
+            chip8_Store(VF, _mm256_and_si256(chip8_Load(Vx), _mm256_set1_epi8(0x80)), m);
+            a = chip8_Load(Vx);
+            chip8_Store(Vx, _mm256_add_epi8(a, a), m);
+            break;
+        case CHIP8_OP_LD_VX_DT :
+            chip8_Store(Vx, chip8_Load(&ls->DT[base]), m);
+            break;
+        case CHIP8_OP_LD_DT_VX :
+            chip8_Store(&ls->DT[base], chip8_Load(Vx), m);
+            break;
+        case CHIP8_OP_LD_ST_VX :
+            chip8_Store(&ls->ST[base], chip8_Load(Vx), m);
+            break;
+        case CHIP8_OP_LD_I :
+        case CHIP8_OP_ADD_I_VX :
+        case CHIP8_OP_LD_F_VX :
+            b = chip8_Load(Vx);
+            for (int h = 0; h < 2; h++) {
+                unsigned short *I = &ls->I[base + 16 * h];
+                __m256i vx = chip8_Widen(b, h, false);
+                __m256i val = ins->op == CHIP8_OP_LD_I     ? _mm256_set1_epi16(ins->nnn) :
+                              ins->op == CHIP8_OP_ADD_I_VX ? _mm256_add_epi16(chip8_Load(I), vx) :
+                                                             _mm256_mullo_epi16(vx, _mm256_set1_epi16(CHIP8_DEFAULT_SPRITE_HEIGHT));
+                chip8_Store(I, val, chip8_Widen(m, h, true));
+            }
+            break;
+    }
+
+    // PC moves past the instruction, two more on a skip, or jumps
+    b = chip8_Load(V0);
+    for (int h = 0; h < 2; h++) {
+        unsigned short *PC = &ls->PC[base + 16 * h];
+        __m256i next;
+        if (ins->op == CHIP8_OP_JP) {
+            next = _mm256_set1_epi16(ins->nnn);
+        } else if (ins->op == CHIP8_OP_JP_V0) {
+            next = _mm256_add_epi16(_mm256_set1_epi16(ins->nnn), chip8_Widen(b, h, false));
+        } else {
+            // skip lanes are -1, subtracting twice that adds 2
+            __m256i s = chip8_Widen(skip, h, true);
+            next = _mm256_sub_epi16(_mm256_add_epi16(chip8_Load(PC), _mm256_set1_epi16(2)), _mm256_add_epi16(s, s));
+        }
+        chip8_Store(PC, next, chip8_Widen(m, h, true));
+    }
+}
+
+CHIP8_AVX2 static void chip8_LockstepRunVector ( chip8Lockstep *ls, int base, int end, int cycles) {
+    const uint32_t active = end - base == CHIP8_LOCKSTEP_LANES ? 0xffffffff : ((uint32_t) 1 << (end - base)) - 1;
+    for (int c = 0; c < cycles; c++) {
+        // Each pass takes the lanes at the PC of the first lane left
+        uint32_t left = active;
+        while (left) {
+            int leader = base + __builtin_ctz(left);
+            unsigned short pc = ls->PC[leader];
+            if ((pc & 1) || pc + 1 >= CHIP8_MEM_SIZE) {
+                chip8_LockstepStep(ls, leader);
+                left &= left - 1;
+                continue;
+            }
+
+            unsigned short opcode = chip8_FetchInstructionMem(&ls->chips[leader].memory, pc);
+            uint32_t group = chip8_LockstepSamePC(ls, base, pc) & left;
+            // lanes sharing the leader's page share its code, the others
+            // stored to it and may hold something else at pc
+            const chip8Page *page = ls->chips[leader].memory.pages[pc / CHIP8_PAGE_SIZE];
+            for (uint32_t g = group; g; g &= g - 1) {
+                int i = base + __builtin_ctz(g);
+                if (ls->chips[i].memory.pages[pc / CHIP8_PAGE_SIZE] != page &&
+                    chip8_FetchInstructionMem(&ls->chips[i].memory, pc) != opcode)
+                    group &= ~((uint32_t) 1 << (i - base));
+            }
+            left &= ~group;
+
+            chip8Instruction ins;
+            chip8_DecodeInstruction(opcode, &ins);
+            if (chip8_LockstepIsVectorOp(ins.op)) {
+                chip8_LockstepVector(ls, base, group, &ins);
+            } else {
+                for (; group; group &= group - 1) {
+                    chip8_LockstepStep(ls, base + __builtin_ctz(group));
+                }
+            }
+        }
+    }
+}
+
+static bool chip8_LockstepHasSimd ( void ) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+static bool chip8_LockstepHasSimd ( void ) {
+    return false;
+}
+
+static void chip8_LockstepRunVector ( chip8Lockstep *ls, int base, int end, int cycles) {
+    chip8_LockstepRunScalar(ls, base, end, cycles);
+}
+
+#endif
+
+//-----------------------------------------------------------------
+// CHIP8 LOCKSTEP FUNCTIONS
+//-----------------------------------------------------------------
+chip8Lockstep * chip8_LockstepCreate ( int count, const char *buff, size_t size) {
+    chip8Lockstep *ls = calloc(1, sizeof(chip8Lockstep));
+    if (!ls)
+        return NULL;
+    ls->count = count;
+    ls->lanes = (count + CHIP8_LOCKSTEP_LANES - 1) / CHIP8_LOCKSTEP_LANES * CHIP8_LOCKSTEP_LANES;
+    ls->chips = calloc(count, sizeof(chip8));
+    ls->V  = calloc(V_REGISTER_COUNT * ls->lanes, sizeof(unsigned char));
+    ls->I  = calloc(ls->lanes, sizeof(unsigned short));
+    ls->PC = calloc(ls->lanes, sizeof(unsigned short));
+    ls->DT = calloc(ls->lanes, sizeof(unsigned char));
+    ls->ST = calloc(ls->lanes, sizeof(unsigned char));
+    if (!ls->chips || !ls->V || !ls->I || !ls->PC || !ls->DT || !ls->ST) {
+        // no instance holds pages yet
+        ls->count = 0;
+        chip8_LockstepDestroy(ls);
+        return NULL;
+    }
+    ls->simd = chip8_LockstepHasSimd();
+
+    // Every instance starts on the RAM pages of the first
+    chip8_init(&ls->chips[0]);
+    chip8_LoadProgram(&ls->chips[0], buff, size);
+    for (int i = 0; i < count; i++) {
+        if (i > 0)
+            chip8_Fork(&ls->chips[i], &ls->chips[0]);
+        chip8_LockstepStore(ls, i);
+    }
+    return ls;
+}
+
+void chip8_LockstepDestroy ( chip8Lockstep *ls) {
+    if (!ls)
+        return;
+    for (int i = 0; i < ls->count; i++) {
+        chip8_Release(&ls->chips[i]);
+    }
+    free(ls->chips);
+    free(ls->V);
+    free(ls->I);
+    free(ls->PC);
+    free(ls->DT);
+    free(ls->ST);
+    free(ls);
+}
+
+void chip8_LockstepRun ( chip8Lockstep *ls, int cycles) {
+    // Chunks are independent, so each runs all its cycles while its
+    // registers are in cache
+    for (int base = 0; base < ls->count; base += CHIP8_LOCKSTEP_LANES) {
+        int end = base + CHIP8_LOCKSTEP_LANES < ls->count ? base + CHIP8_LOCKSTEP_LANES : ls->count;
+        // simd is only set when the CPU has AVX2
+        if (ls->simd)
+            chip8_LockstepRunVector(ls, base, end, cycles);
+        else
+            chip8_LockstepRunScalar(ls, base, end, cycles);
+    }
+}
+
+void chip8_LockstepTickTimers ( chip8Lockstep *ls) {
+    for (int i = 0; i < ls->count; i++) {
+        if (ls->DT[i] > 0)
+            ls->DT[i] -= 1;
+        if (ls->ST[i] > 0)
+            ls->ST[i] -= 1;
+    }
+}
+
+bool chip8_LockstepSetSimd ( chip8Lockstep *ls, bool enable) {
+    ls->simd = enable && chip8_LockstepHasSimd();
+    return ls->simd;
+}
+
+chip8 * chip8_LockstepGetChip ( chip8Lockstep *ls, int i) {
+    assert( i >= 0 && i < ls->count);
+    chip8_LockstepLoad(ls, i);
+    return &ls->chips[i];
+}
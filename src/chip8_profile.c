@@ -0,0 +1,84 @@
+#include "../include/chip8_profile.h"
+
+#ifdef CHIP8_PROFILE
+
+#include <stdlib.h>
+
+// Rows printed for the opcode and address tables
+#define CHIP8_PROFILE_TOP 20
+
+static uint64_t chip8_profile_ops[CHIP8_OP_FUSED];
+static uint64_t chip8_profile_opcodes[0x10000];
+static uint64_t chip8_profile_pcs[CHIP8_MEM_SIZE];
+
+void chip8_ProfileCount ( int pc, unsigned short opcode) {
+    chip8_profile_ops[chip8_GetOp(opcode)]++;
+    chip8_profile_opcodes[opcode]++;
+    chip8_profile_pcs[pc % CHIP8_MEM_SIZE]++;
+}
+
+//-----------------------------------------------------------------
+// CHIP8 PROFILE REPORT
+//-----------------------------------------------------------------
+// qsort has no context argument, the table being sorted is set here
+static const uint64_t *chip8_profile_sorting;
+
+static int chip8_ProfileCompare ( const void *a, const void *b) {
+    uint64_t x = chip8_profile_sorting[*(const int *) a];
+    uint64_t y = chip8_profile_sorting[*(const int *) b];
+    return x < y ? 1 : x > y ? -1 : *(const int *) a - *(const int *) b;
+}
+
+// Fills order with the indices of counts, highest count first
+static void chip8_ProfileSort ( const uint64_t *counts, int *order, int n) {
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    chip8_profile_sorting = counts;
+    qsort(order, n, sizeof(int), chip8_ProfileCompare);
+}
+
+void chip8_ProfileReport ( FILE *out) {
+    static int order[0x10000];
+    uint64_t total = 0;
+    for (int i = 0; i < CHIP8_OP_FUSED; i++) {
+        total += chip8_profile_ops[i];
+    }
+    if (total == 0)
+        return;
+
+    fprintf(out, "chip8 profile: %llu instructions\n", (unsigned long long) total);
+    fprintf(out, "\n%-14s %14s %7s\n", "op", "count", "%");
+    chip8_ProfileSort(chip8_profile_ops, order, CHIP8_OP_FUSED);
+    for (int i = 0; i < CHIP8_OP_FUSED && chip8_profile_ops[order[i]]; i++) {
+        fprintf(out, "%-14s %14llu %6.2f%%\n", chip8_GetOpName(order[i]),
+                (unsigned long long) chip8_profile_ops[order[i]], 100.0 * chip8_profile_ops[order[i]] / total);
+    }
+
+    fprintf(out, "\n%-14s %14s %7s\n", "opcode", "count", "%");
+    chip8_ProfileSort(chip8_profile_opcodes, order, 0x10000);
+    for (int i = 0; i < CHIP8_PROFILE_TOP && chip8_profile_opcodes[order[i]]; i++) {
+        fprintf(out, "%04x %-9s %14llu %6.2f%%\n", order[i], chip8_GetOpName(chip8_GetOp(order[i])),
+                (unsigned long long) chip8_profile_opcodes[order[i]], 100.0 * chip8_profile_opcodes[order[i]] / total);
+    }
+
+    fprintf(out, "\n%-14s %14s %7s\n", "address", "count", "%");
+    chip8_ProfileSort(chip8_profile_pcs, order, CHIP8_MEM_SIZE);
+    for (int i = 0; i < CHIP8_PROFILE_TOP && chip8_profile_pcs[order[i]]; i++) {
+        fprintf(out, "%03x            %14llu %6.2f%%\n", order[i],
+                (unsigned long long) chip8_profile_pcs[order[i]], 100.0 * chip8_profile_pcs[order[i]] / total);
+    }
+}
+
+static void chip8_ProfileExit ( void ) {
+    chip8_ProfileReport(stderr);
+}
+
+void chip8_ProfileInit ( void ) {
+    // one registration however many threads call chip8_init
+    static bool registered;
+    if (!__atomic_exchange_n(&registered, true, __ATOMIC_ACQ_REL))
+        atexit(chip8_ProfileExit);
+}
+
+#endif
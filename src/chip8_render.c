@@ -0,0 +1,143 @@
+#include "../include/chip8_render.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHIP8_PIXEL_ON  0xffffffff
+#define CHIP8_PIXEL_OFF 0xff000000
+
+struct chip8Renderer {
+    SDL_Renderer *renderer;
+    SDL_Texture *texture;
+};
+
+//-----------------------------------------------------------------
+// CHIP8 RENDERER FUNCTIONS
+//-----------------------------------------------------------------
+chip8Renderer * chip8_RendererCreate ( SDL_Window *window) {
+    chip8Renderer *r = calloc(1, sizeof(chip8Renderer));
+    if (!r)
+        return NULL;
+
+    // nearest neighbour keeps the pixels sharp when scaled
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    r->renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    if (!r->renderer)
+        r->renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    if (!r->renderer) {
+        printf("[!ERROR] error from renderer creation : %s \n", SDL_GetError());
+        chip8_RendererDestroy(r);
+        return NULL;
+    }
+
+    r->texture = SDL_CreateTexture(r->renderer, SDL_PIXELFORMAT_ARGB8888,
+                                   SDL_TEXTUREACCESS_STREAMING, WIN_WIDTH, WIN_HEIGHT);
+    if (!r->texture) {
+        printf("[!ERROR] error from texture creation : %s \n", SDL_GetError());
+        chip8_RendererDestroy(r);
+        return NULL;
+    }
+    return r;
+}
+
+void chip8_RendererDestroy ( chip8Renderer *r) {
+    if (!r)
+        return;
+    if (r->texture)
+        SDL_DestroyTexture(r->texture);
+    if (r->renderer)
+        SDL_DestroyRenderer(r->renderer);
+    free(r);
+}
+
+// Rewrites the texture rows from first to last
+static void chip8_RendererUpload ( chip8Renderer *r, const chip8Screen *screen, int first, int last) {
+    // locked pixels are write-only, so every row in the rect is rewritten
+    SDL_Rect rect = { 0, first, WIN_WIDTH, last - first + 1 };
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(r->texture, &rect, &pixels, &pitch) < 0) {
+        printf("[!ERROR] error from texture lock : %s \n", SDL_GetError());
+        return;
+    }
+    for (int y = first; y <= last; y++) {
+        Uint32 *dst = (Uint32 *) ((Uint8 *) pixels + (y - first) * pitch);
+        uint64_t row = chip8_GetScreenRow(screen, y);
+        for (int x = 0; x < WIN_WIDTH; x++) {
+            dst[x] = (row >> (WIN_WIDTH - 1 - x)) & 1 ? CHIP8_PIXEL_ON : CHIP8_PIXEL_OFF;
+        }
+    }
+    SDL_UnlockTexture(r->texture);
+}
+
+void chip8_RendererPresent ( chip8Renderer *r, const chip8Screen *screen, uint32_t dirty_rows) {
+    if (dirty_rows) {
+        int first = 0, last = WIN_HEIGHT - 1;
+        while (!(dirty_rows >> first & 1))
+            first++;
+        while (!(dirty_rows >> last & 1))
+            last--;
+        chip8_RendererUpload(r, screen, first, last);
+    }
+
+    // scaled to the WIN_MULTIPLIER sized window
+    SDL_RenderCopy(r->renderer, r->texture, NULL, NULL);
+    SDL_RenderPresent(r->renderer);
+}
+
+//-----------------------------------------------------------------
+// CHIP8 FRAME QUEUE FUNCTIONS
+//-----------------------------------------------------------------
+// Triple buffer: the emulation thread writes buffers[back], the main
+// thread reads buffers[front] and the third index sits in middle. Both
+// sides swap their buffer with middle in one atomic exchange.
+// CHIP8_FRAME_FRESH marks a middle buffer the main thread has not taken.
+#define CHIP8_FRAME_FRESH 4
+
+struct chip8FrameQueue {
+    SDL_atomic_t middle;
+    int back;                   // emulation thread only
+    int front;                  // main thread only
+    bool taken;                 // main thread only, shown holds a frame
+    chip8Screen shown;          // main thread only, rows of the last frame taken
+    chip8Screen buffers[3];
+};
+
+chip8FrameQueue * chip8_FrameQueueCreate ( void ) {
+    chip8FrameQueue *q = calloc(1, sizeof(chip8FrameQueue));
+    if (!q) {
+        printf("[!ERROR] out of memory for the frame queue \n");
+        return NULL;
+    }
+    q->back  = 0;
+    q->front = 1;
+    SDL_AtomicSet(&q->middle, 2);
+    return q;
+}
+
+void chip8_FrameQueueDestroy ( chip8FrameQueue *q) {
+    free(q);
+}
+
+void chip8_FrameQueuePublish ( chip8FrameQueue *q, const chip8Screen *screen) {
+    q->buffers[q->back] = *screen;
+    SDL_MemoryBarrierRelease();
+    q->back = SDL_AtomicSet(&q->middle, q->back | CHIP8_FRAME_FRESH) & ~CHIP8_FRAME_FRESH;
+}
+
+const chip8Screen * chip8_FrameQueueTake ( chip8FrameQueue *q, uint32_t *dirty_rows) {
+    if (!(SDL_AtomicGet(&q->middle) & CHIP8_FRAME_FRESH))
+        return NULL;
+    q->front = SDL_AtomicSet(&q->middle, q->front) & ~CHIP8_FRAME_FRESH;
+    SDL_MemoryBarrierAcquire();
+
+    // frames may have been skipped, so dirty rows come from a compare
+    const chip8Screen *frame = &q->buffers[q->front];
+    *dirty_rows = 0;
+    for (int y = 0; y < WIN_HEIGHT; y++) {
+        if (!q->taken || frame->rows[y] != q->shown.rows[y])
+            *dirty_rows |= (uint32_t) 1 << y;
+    }
+    memcpy(q->shown.rows, frame->rows, sizeof(q->shown.rows));
+    q->taken = true;
+    return frame;
+}
@@ -0,0 +1,218 @@
+#include "../include/chip8_rewind.h"
+#include <stdlib.h>
+#include <assert.h>
+
+// A literal run ends at this many zero bytes in a row. Every run but the
+// first then starts after at least that many zeros, which bounds an
+// encoding at two bytes per state byte plus two run headers.
+#define CHIP8_REWIND_MIN_ZEROS   4
+#define CHIP8_REWIND_ENCODED_MAX (2 * CHIP8_STATE_SIZE + 8)
+
+#if CHIP8_STATE_SIZE > 0xffff
+#error "chip8 rewind run lengths are 16-bit"
+#endif
+
+typedef struct chip8RewindFrame {
+    uint32_t offset;
+    uint32_t size : 31;
+    uint32_t key  : 1;
+} chip8RewindFrame;
+
+struct chip8Rewind {
+    unsigned char *data;
+    size_t bytes;
+    size_t head;                // where the next frame is written
+    // frames oldest first, the oldest is always a keyframe
+    chip8RewindFrame *frames;
+    int frame_max;
+    int first;
+    int count;
+    int since_key;              // frames of the newest keyframe, itself included
+    unsigned char key[CHIP8_STATE_SIZE];
+    unsigned char state[CHIP8_STATE_SIZE];
+    unsigned char encoded[CHIP8_REWIND_ENCODED_MAX];
+};
+
+//-----------------------------------------------------------------
+// CHIP8 REWIND ENCODING
+//-----------------------------------------------------------------
+// state XOR base as pairs of 16-bit zero count, 16-bit literal count and the
+// literal bytes. A NULL base is all zeros.
+static unsigned char chip8_RewindXor ( const unsigned char *state, const unsigned char *base, size_t i) {
+    return base ? state[i] ^ base[i] : state[i];
+}
+
+static unsigned char * chip8_RewindPut16 ( unsigned char *p, size_t val) {
+    p[0] = val;
+    p[1] = val >> 8;
+    return p + 2;
+}
+
+static size_t chip8_RewindEncode ( unsigned char *out, const unsigned char *state, const unsigned char *base) {
+    unsigned char *p = out;
+    size_t i = 0;
+    while (i < CHIP8_STATE_SIZE) {
+        size_t start = i;
+        while (start < CHIP8_STATE_SIZE && chip8_RewindXor(state, base, start) == 0) {
+            start++;
+        }
+        size_t end = start, zeros = 0;
+        while (end < CHIP8_STATE_SIZE && zeros < CHIP8_REWIND_MIN_ZEROS) {
+            zeros = chip8_RewindXor(state, base, end) == 0 ? zeros + 1 : 0;
+            end++;
+        }
+        if (zeros == CHIP8_REWIND_MIN_ZEROS)
+            end -= zeros;
+
+        p = chip8_RewindPut16(p, start - i);
+        p = chip8_RewindPut16(p, end - start);
+        for (size_t j = start; j < end; j++) {
+            *p++ = chip8_RewindXor(state, base, j);
+        }
+        i = end;
+    }
+    assert( p - out <= CHIP8_REWIND_ENCODED_MAX);
+    return p - out;
+}
+
+static void chip8_RewindDecode ( unsigned char *state, const unsigned char *in, size_t size, const unsigned char *base) {
+    if (base)
+        memcpy(state, base, CHIP8_STATE_SIZE);
+    else
+        memset(state, 0, CHIP8_STATE_SIZE);
+
+    const unsigned char *end = in + size;
+    size_t i = 0;
+    while (in < end) {
+        i += in[0] | in[1] << 8;
+        size_t literals = in[2] | in[3] << 8;
+        in += 4;
+        assert( i + literals <= CHIP8_STATE_SIZE);
+        for (size_t j = 0; j < literals; j++) {
+            state[i++] ^= *in++;
+        }
+    }
+}
+
+//-----------------------------------------------------------------
+// CHIP8 REWIND RING
+//-----------------------------------------------------------------
+// Finds size contiguous free bytes after the newest frame, wrapping to the
+// start of the ring when they do not fit before its end
+static bool chip8_RewindFits ( chip8Rewind *rw, size_t size, size_t *at) {
+    if (rw->count == 0) {
+        rw->head = 0;
+        *at = 0;
+        return size <= rw->bytes;
+    }
+    size_t tail = rw->frames[rw->first].offset;
+    if (rw->head > tail) {
+        // frames fill [tail, head)
+        if (rw->head + size <= rw->bytes) {
+            *at = rw->head;
+            return true;
+        }
+        *at = 0;
+        return size <= tail;
+    }
+    // frames wrapped, [head, tail) is free and head == tail means full
+    *at = rw->head;
+    return rw->head + size <= tail;
+}
+
+// Drops the oldest keyframe and the frames encoded against it
+static void chip8_RewindDropOldest ( chip8Rewind *rw) {
+    do {
+        rw->first = (rw->first + 1) % rw->frame_max;
+        rw->count--;
+    } while (rw->count > 0 && !rw->frames[rw->first].key);
+}
+
+static chip8RewindFrame * chip8_RewindFrame ( chip8Rewind *rw, int back) {
+    return &rw->frames[(rw->first + rw->count - 1 - back) % rw->frame_max];
+}
+
+//-----------------------------------------------------------------
+// CHIP8 REWIND FUNCTIONS
+//-----------------------------------------------------------------
+chip8Rewind * chip8_RewindCreate ( size_t bytes, int frames) {
+    chip8Rewind *rw = calloc(1, sizeof(chip8Rewind));
+    if (!rw)
+        return NULL;
+    rw->data = malloc(bytes);
+    rw->frames = calloc(frames, sizeof(chip8RewindFrame));
+    if (!rw->data || !rw->frames || frames < 1) {
+        chip8_RewindDestroy(rw);
+        return NULL;
+    }
+    rw->bytes = bytes;
+    rw->frame_max = frames;
+    return rw;
+}
+
+void chip8_RewindDestroy ( chip8Rewind *rw) {
+    if (!rw)
+        return;
+    free(rw->data);
+    free(rw->frames);
+    free(rw);
+}
+
+void chip8_RewindCapture ( chip8Rewind *rw, const chip8 *chip) {
+    chip8_SaveState(chip, rw->state, sizeof(rw->state));
+    bool key = rw->count == 0 || rw->since_key >= CHIP8_REWIND_KEYFRAME_INTERVAL;
+
+    size_t size, at;
+    for (;;) {
+        size = chip8_RewindEncode(rw->encoded, rw->state, key ? NULL : rw->key);
+        if (size > rw->bytes)
+            return;
+        while (rw->count == rw->frame_max || !chip8_RewindFits(rw, size, &at)) {
+            chip8_RewindDropOldest(rw);
+        }
+        // the ring only had room once the newest keyframe was gone
+        if (!key && rw->count == 0) {
+            key = true;
+            continue;
+        }
+        break;
+    }
+
+    memcpy(rw->data + at, rw->encoded, size);
+    *chip8_RewindFrame(rw, -1) = (chip8RewindFrame) { at, size, key };
+    rw->count++;
+    rw->head = at + size;
+    if (key) {
+        memcpy(rw->key, rw->state, CHIP8_STATE_SIZE);
+        rw->since_key = 1;
+    } else {
+        rw->since_key++;
+    }
+}
+
+bool chip8_RewindStep ( chip8Rewind *rw, chip8 *chip) {
+    if (rw->count == 0)
+        return false;
+    chip8RewindFrame frame = *chip8_RewindFrame(rw, 0);
+    chip8_RewindDecode(rw->state, rw->data + frame.offset, frame.size, frame.key ? NULL : rw->key);
+    rw->count--;
+    rw->head = frame.offset;
+
+    if (!frame.key) {
+        rw->since_key--;
+    } else if (rw->count > 0) {
+        // the previous keyframe is the newest again
+        int back = 0;
+        while (!chip8_RewindFrame(rw, back)->key) {
+            back++;
+        }
+        const chip8RewindFrame *key = chip8_RewindFrame(rw, back);
+        chip8_RewindDecode(rw->key, rw->data + key->offset, key->size, NULL);
+        rw->since_key = back + 1;
+    }
+    return chip8_LoadState(chip, rw->state, CHIP8_STATE_SIZE);
+}
+
+int chip8_RewindFrames ( const chip8Rewind *rw) {
+    return rw->count;
+}
@@ -0,0 +1,335 @@
+#include "../include/chip8.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+//-----------------------------------------------------------------
+// CHIP8 SYNTHETIC ROM GENERATOR
+//-----------------------------------------------------------------
+// Writes a ROM that runs a random loop body a fixed number of times and
+// then halts on a jump to itself, for benchmarking the cores on op mixes
+// that real games rarely reach.
+//
+//   chip8romgen <mix> <output.ch8> [-seed n] [-units n] [-loops n] [-subs n]
+//
+// mix is a preset (alu, draw, call, smc, bulk or mixed) or a list of
+// kind:weight pairs, e.g. alu:4,draw:1,bulk:1. The kinds are
+//
+//   alu    one ALU, timer or RND op, or a skip over one
+//   draw   a sprite from the data area or the font, or a clear
+//   call   a call into one of the subroutines
+//   smc    Fx55 rewriting the 6xkk right after it with a random byte
+//   bulk   Fx55, Fx65 or Fx33 on the data area
+//
+// The generated code never jumps backwards except for the loop, skips only
+// ever skip a single non-branching op, subroutine i only calls subroutines
+// after it, at most once, and Fx0A is never used, so every ROM reaches the
+// halt after at most loops times the body plus its calls.
+//
+// Layout: a jump to main, CHIP8_GEN_DATA_SIZE random data bytes, the
+// subroutines, then main: the register setup, the loop and the halt.
+
+#define CHIP8_GEN_UNITS     64
+#define CHIP8_GEN_LOOPS     10000
+#define CHIP8_GEN_SUBS      8
+#define CHIP8_GEN_SUB_UNITS 8
+#define CHIP8_GEN_DATA_SIZE 256
+
+// The loop counter lives in VD:VE, random ops use the other registers
+#define CHIP8_GEN_COUNT_HI 0xD
+#define CHIP8_GEN_COUNT_LO 0xE
+
+typedef enum chip8GenKind {
+    CHIP8_GEN_ALU,
+    CHIP8_GEN_DRAW,
+    CHIP8_GEN_CALL,
+    CHIP8_GEN_SMC,
+    CHIP8_GEN_BULK,
+    CHIP8_GEN_KINDS
+} chip8GenKind;
+
+static const char *chip8_GenKindNames[CHIP8_GEN_KINDS] = { "alu", "draw", "call", "smc", "bulk" };
+
+static const struct {
+    const char *name;
+    int weights[CHIP8_GEN_KINDS];
+} chip8_GenPresets[] = {
+    { "alu",   { 1, 0, 0, 0, 0 } },
+    { "draw",  { 1, 3, 0, 0, 0 } },
+    { "call",  { 1, 0, 3, 0, 0 } },
+    { "smc",   { 1, 0, 0, 3, 0 } },
+    { "bulk",  { 1, 0, 0, 0, 3 } },
+    { "mixed", { 1, 1, 1, 1, 1 } },
+};
+
+static unsigned char rom[CHIP8_MEM_SIZE - CHIP8_PROGRAM_LOAD_ADDR];
+static int addr = CHIP8_PROGRAM_LOAD_ADDR;   // where the next op goes
+static int data_addr;
+static int weights[CHIP8_GEN_KINDS];
+static int weight_total;
+static int sub_addr[CHIP8_STACK_SIZE];
+static int sub_count = CHIP8_GEN_SUBS;
+static int calls_left;                      // per subroutine, -1 in main
+static uint64_t rng = CHIP8_DEFAULT_SEED;
+
+// xorshift64*, the same generator the core uses for Cxkk
+static int chip8_GenRandom ( int range) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return ((rng * 0x2545f4914f6cdd1dull) >> 32) % range;
+}
+
+static void chip8_GenEmit ( unsigned short opcode) {
+    if (addr + 1 >= CHIP8_MEM_SIZE) {
+        printf("[ERROR] the ROM does not fit in memory, use less -units or -subs \n");
+        exit(-1);
+    }
+    rom[addr - CHIP8_PROGRAM_LOAD_ADDR]     = opcode >> 8;
+    rom[addr - CHIP8_PROGRAM_LOAD_ADDR + 1] = opcode;
+    addr += 2;
+}
+
+// Any register but the loop counter
+static int chip8_GenReg ( void ) {
+    int r = chip8_GenRandom(V_REGISTER_COUNT - 2);
+    return r < CHIP8_GEN_COUNT_HI ? r : 0xF;
+}
+
+// I somewhere in the data area with room for 16 bytes after it
+static void chip8_GenDataI ( void ) {
+    chip8_GenEmit(0xA000 | (data_addr + chip8_GenRandom(CHIP8_GEN_DATA_SIZE - 16)));
+}
+
+//-----------------------------------------------------------------
+// CHIP8 GENERATOR UNITS
+//-----------------------------------------------------------------
+// One op that neither branches nor skips
+static void chip8_GenAluOp ( void ) {
+    int x = chip8_GenReg(), y = chip8_GenReg(), kk = chip8_GenRandom(256);
+    static const unsigned char alu[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+    switch (chip8_GenRandom(8)) {
+        case 0  : chip8_GenEmit(0x6000 | x << 8 | kk); break;
+        case 1  :
+        case 2  : chip8_GenEmit(0x7000 | x << 8 | kk); break;
+        case 3  : chip8_GenEmit(0xC000 | x << 8 | kk); break;
+        case 4  : chip8_GenEmit(0xF000 | x << 8 | (chip8_GenRandom(2) ? 0x07 : 0x15)); break;
+        case 5  : chip8_GenEmit(0xF01E | x << 8); break;
+        default : chip8_GenEmit(0x8000 | x << 8 | y << 4 | alu[chip8_GenRandom(sizeof(alu))]); break;
+    }
+}
+
+static void chip8_GenAlu ( void ) {
+    if (chip8_GenRandom(4) != 0) {
+        chip8_GenAluOp();
+        return;
+    }
+    // a skip together with the op it may skip
+    int x = chip8_GenReg(), y = chip8_GenReg(), kk = chip8_GenRandom(256);
+    switch (chip8_GenRandom(5)) {
+        case 0  : chip8_GenEmit(0x3000 | x << 8 | kk); break;
+        case 1  : chip8_GenEmit(0x4000 | x << 8 | kk); break;
+        case 2  : chip8_GenEmit(0x5000 | x << 8 | y << 4); break;
+        case 3  : chip8_GenEmit(0x9000 | x << 8 | y << 4); break;
+        default :
+            // key skips index the keyboard with Vx, keep it a key
+            chip8_GenEmit(0x6000 | x << 8 | chip8_GenRandom(CHIP8_KEYBOARD_SIZE));
+            chip8_GenEmit(0xE000 | x << 8 | (chip8_GenRandom(2) ? 0x9E : 0xA1));
+            break;
+    }
+    chip8_GenAluOp();
+}
+
+static void chip8_GenDraw ( void ) {
+    int x = chip8_GenReg(), y = chip8_GenReg();
+    switch (chip8_GenRandom(10)) {
+        case 0  :
+            chip8_GenEmit(0x00E0);
+            break;
+        case 1  :
+        case 2  :
+        case 3  :
+            chip8_GenEmit(0xF029 | chip8_GenReg() << 8);
+            chip8_GenEmit(0xD000 | x << 8 | y << 4 | CHIP8_DEFAULT_SPRITE_HEIGHT);
+            break;
+        default :
+            chip8_GenDataI();
+            chip8_GenEmit(0xD000 | x << 8 | y << 4 | (1 + chip8_GenRandom(CHIP8_SPRITE_MAX_ROWS - 1)));
+            break;
+    }
+}
+
+// Calls a subroutine after sub, -1 for the main loop. A subroutine makes
+// one call at most, so a call from main runs at most sub_count bodies.
+static void chip8_GenCall ( int sub) {
+    int first = sub + 1;
+    if (first >= sub_count || calls_left == 0) {
+        chip8_GenAlu();
+        return;
+    }
+    chip8_GenEmit(0x2000 | sub_addr[first + chip8_GenRandom(sub_count - first)]);
+    if (calls_left > 0)
+        calls_left--;
+}
+
+static void chip8_GenSmc ( void ) {
+    // V0 and V1 are the bytes of the 6xkk written to the slot
+    int slot = addr + 8;
+    int r = chip8_GenReg();
+    chip8_GenEmit(0x6060 | r);
+    chip8_GenEmit(0xC1FF);
+    chip8_GenEmit(0xA000 | slot);
+    chip8_GenEmit(0xF155);
+    chip8_GenEmit(0x6000 | r << 8);
+}
+
+static void chip8_GenBulk ( void ) {
+    chip8_GenDataI();
+    switch (chip8_GenRandom(3)) {
+        case 0  : chip8_GenEmit(0xF055 | chip8_GenRandom(V_REGISTER_COUNT) << 8); break;
+        // Fx65 stops short of the loop counter
+        case 1  : chip8_GenEmit(0xF065 | chip8_GenRandom(CHIP8_GEN_COUNT_HI) << 8); break;
+        default : chip8_GenEmit(0xF033 | chip8_GenReg() << 8); break;
+    }
+}
+
+static void chip8_GenUnits ( int count, int sub) {
+    for (int i = 0; i < count; i++) {
+        int pick = chip8_GenRandom(weight_total);
+        int kind = 0;
+        while (pick >= weights[kind]) {
+            pick -= weights[kind++];
+        }
+        switch (kind) {
+            case CHIP8_GEN_ALU  : chip8_GenAlu();     break;
+            case CHIP8_GEN_DRAW : chip8_GenDraw();    break;
+            case CHIP8_GEN_CALL : chip8_GenCall(sub); break;
+            case CHIP8_GEN_SMC  : chip8_GenSmc();     break;
+            case CHIP8_GEN_BULK : chip8_GenBulk();    break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------
+// CHIP8 GENERATOR
+//-----------------------------------------------------------------
+static bool chip8_GenParseMix ( const char *mix) {
+    for (size_t i = 0; i < sizeof(chip8_GenPresets) / sizeof(chip8_GenPresets[0]); i++) {
+        if (strcmp(mix, chip8_GenPresets[i].name) == 0) {
+            memcpy(weights, chip8_GenPresets[i].weights, sizeof(weights));
+            return true;
+        }
+    }
+    while (*mix) {
+        size_t len = strcspn(mix, ":,");
+        int kind = 0;
+        while (kind < CHIP8_GEN_KINDS && (strlen(chip8_GenKindNames[kind]) != len
+               || strncmp(mix, chip8_GenKindNames[kind], len) != 0)) {
+            kind++;
+        }
+        if (kind == CHIP8_GEN_KINDS)
+            return false;
+        mix += len;
+        weights[kind] = 1;
+        if (*mix == ':')
+            weights[kind] = strtol(mix + 1, (char **) &mix, 10);
+        if (weights[kind] < 0 || (*mix && *mix++ != ','))
+            return false;
+    }
+    return true;
+}
+
+static void chip8_GenRom ( int units, long loops) {
+    // jump over the data and the subroutines, patched once main is placed
+    chip8_GenEmit(0x1000);
+    data_addr = addr;
+    for (int i = 0; i < CHIP8_GEN_DATA_SIZE; i++) {
+        rom[addr++ - CHIP8_PROGRAM_LOAD_ADDR] = chip8_GenRandom(256);
+    }
+
+    // the last one first so every callee is placed before its callers
+    if (!weights[CHIP8_GEN_CALL])
+        sub_count = 0;
+    for (int sub = sub_count - 1; sub >= 0; sub--) {
+        sub_addr[sub] = addr;
+        calls_left = 1;
+        chip8_GenUnits(CHIP8_GEN_SUB_UNITS, sub);
+        chip8_GenEmit(0x00EE);
+    }
+    int main_addr = addr;
+    rom[0] = 0x10 | main_addr >> 8;
+    rom[1] = main_addr;
+    for (int r = 0; r < CHIP8_GEN_COUNT_HI; r++) {
+        chip8_GenEmit(0x6000 | r << 8 | chip8_GenRandom(256));
+    }
+    chip8_GenEmit(0x6000 | CHIP8_GEN_COUNT_HI << 8 | (loops >> 8));
+    chip8_GenEmit(0x6000 | CHIP8_GEN_COUNT_LO << 8 | (loops & 0xff));
+
+    int loop = addr;
+    calls_left = -1;
+    chip8_GenUnits(units, -1);
+
+    // VD:VE -= 1, loop again until it reaches zero
+    chip8_GenEmit(0x70FF | CHIP8_GEN_COUNT_LO << 8);
+    chip8_GenEmit(0x40FF | CHIP8_GEN_COUNT_LO << 8);
+    chip8_GenEmit(0x70FF | CHIP8_GEN_COUNT_HI << 8);
+    chip8_GenEmit(0x3000 | CHIP8_GEN_COUNT_LO << 8);
+    chip8_GenEmit(0x1000 | loop);
+    chip8_GenEmit(0x3000 | CHIP8_GEN_COUNT_HI << 8);
+    chip8_GenEmit(0x1000 | loop);
+    chip8_GenEmit(0x1000 | addr);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("[ERROR] usage: chip8romgen <mix> <output.ch8> [-seed n] [-units n] [-loops n] [-subs n]\n");
+        return -1;
+    }
+    if (!chip8_GenParseMix(argv[1])) {
+        printf("[ERROR] unknown mix %s, use alu, draw, call, smc, bulk, mixed or kind:weight,... \n", argv[1]);
+        return -1;
+    }
+
+    int units = CHIP8_GEN_UNITS;
+    long loops = CHIP8_GEN_LOOPS;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-seed") == 0) {
+            rng = strtoull(argv[i + 1], NULL, 0);
+        } else if (strcmp(argv[i], "-units") == 0) {
+            units = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-loops") == 0) {
+            loops = atol(argv[i + 1]);
+        } else if (strcmp(argv[i], "-subs") == 0) {
+            sub_count = atoi(argv[i + 1]);
+        } else {
+            printf("[ERROR] unknown option %s \n", argv[i]);
+            return -1;
+        }
+    }
+    // calls nest at most one level per subroutine, and chip8_StackPush moves
+    // SP before storing, so the stack holds CHIP8_STACK_SIZE - 1 return addresses
+    if (units < 1 || loops < 1 || loops > 0xffff || sub_count < 0 || sub_count >= CHIP8_STACK_SIZE) {
+        printf("[ERROR] needs -units >= 1, -loops 1-65535 and -subs 0-%d \n", CHIP8_STACK_SIZE - 1);
+        return -1;
+    }
+    for (int kind = 0; kind < CHIP8_GEN_KINDS; kind++) {
+        weight_total += weights[kind];
+    }
+    if (weight_total == 0) {
+        printf("[ERROR] the mix has no weight \n");
+        return -1;
+    }
+    // xorshift64* never leaves zero
+    if (rng == 0)
+        rng = CHIP8_DEFAULT_SEED;
+
+    chip8_GenRom(units, loops);
+
+    FILE *out = fopen(argv[2], "wb");
+    if (!out) {
+        printf("[ERROR] failed to open output file: %s \n", argv[2]);
+        return -1;
+    }
+    fwrite(rom, 1, addr - CHIP8_PROGRAM_LOAD_ADDR, out);
+    fclose(out);
+    return 0;
+}
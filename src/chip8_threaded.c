@@ -0,0 +1,200 @@
+#include "../include/chip8.h"
+#include "../include/chip8_profile.h"
+#include "../include/chip8_trace.h"
+
+//-----------------------------------------------------------------
+// CHIP8 THREADED INTERPRETER
+//-----------------------------------------------------------------
+// Direct threaded variant of chip8_Run built on GCC labels as values.
+// Every handler ends with its own copy of the fetch/decode/dispatch
+// sequence, so each op gets its own indirect branch to predict.
+// Compilers without computed goto fall back to chip8_Run.
+
+#ifdef __GNUC__
+
+int chip8_RunThreaded ( chip8 *chip, int cycles) {
+    static void *labels[CHIP8_OP_COUNT] = {
+        [CHIP8_OP_DECODE]    = &&op_decode,
+        [CHIP8_OP_NOP]       = &&op_nop,
+        [CHIP8_OP_CLS]       = &&op_handler,
+        [CHIP8_OP_RET]       = &&op_handler,
+        [CHIP8_OP_JP]        = &&op_jp,
+        [CHIP8_OP_CALL]      = &&op_handler,
+        [CHIP8_OP_SE_VX_KK]  = &&op_se_vx_kk,
+        [CHIP8_OP_SNE_VX_KK] = &&op_sne_vx_kk,
+        [CHIP8_OP_SE_VX_VY]  = &&op_se_vx_vy,
+        [CHIP8_OP_LD_VX_KK]  = &&op_ld_vx_kk,
+        [CHIP8_OP_ADD_VX_KK] = &&op_add_vx_kk,
+        [CHIP8_OP_LD_VX_VY]  = &&op_ld_vx_vy,
+        [CHIP8_OP_OR]        = &&op_or,
+        [CHIP8_OP_AND]       = &&op_and,
+        [CHIP8_OP_XOR]       = &&op_xor,
+        [CHIP8_OP_ADD_VX_VY] = &&op_add_vx_vy,
+        [CHIP8_OP_SUB]       = &&op_sub,
+        [CHIP8_OP_SHR]       = &&op_shr,
+        [CHIP8_OP_SUBN]      = &&op_subn,
+        [CHIP8_OP_SHL]       = &&op_shl,
+        [CHIP8_OP_SNE_VX_VY] = &&op_sne_vx_vy,
+        [CHIP8_OP_LD_I]      = &&op_ld_i,
+        [CHIP8_OP_JP_V0]     = &&op_jp_v0,
+        [CHIP8_OP_RND]       = &&op_handler,
+        [CHIP8_OP_DRW]       = &&op_handler,
+        [CHIP8_OP_SKP]       = &&op_handler,
+        [CHIP8_OP_SKNP]      = &&op_handler,
+        [CHIP8_OP_LD_VX_DT]  = &&op_ld_vx_dt,
+        [CHIP8_OP_LD_VX_K]   = &&op_handler,
+        [CHIP8_OP_LD_DT_VX]  = &&op_ld_dt_vx,
+        [CHIP8_OP_LD_ST_VX]  = &&op_ld_st_vx,
+        [CHIP8_OP_ADD_I_VX]  = &&op_add_i_vx,
+        [CHIP8_OP_LD_F_VX]   = &&op_ld_f_vx,
+        [CHIP8_OP_LD_B_VX]   = &&op_handler,
+        [CHIP8_OP_LD_I_VX]   = &&op_handler,
+        [CHIP8_OP_LD_VX_I]   = &&op_handler,
+    };
+
+#ifdef CHIP8_TRACE
+    if (chip->trace)
+        return chip8_Run(chip, cycles);
+#endif
+
+    chip8Registers *r = &chip->registers;
+    unsigned char *V = r->V_Registers;
+    chip8Instruction *decoded = chip8_GetDecoded(&chip->memory);
+    const chip8Instruction *ins;
+    unsigned short pc;
+    int executed = 0;
+
+// Fetches the slot at PC, moves PC past it and jumps to its handler.
+// Odd addresses have no slot and go through chip8_Step.
+#define DISPATCH()                                                             \
+    do {                                                                       \
+        if (executed >= cycles)                                                \
+            goto done;                                                         \
+        executed++;                                                            \
+        pc = r->PC;                                                            \
+        if (pc & 1)                                                            \
+            goto op_odd;                                                       \
+        chip8_CheckMemIndexBound(pc + 1);                                      \
+        CHIP8_PROFILE_COUNT(pc, chip8_FetchInstructionMem(&chip->memory, pc)); \
+        ins = &decoded[pc >> 1];                                               \
+        r->PC = pc + 2;                                                        \
+        goto *labels[ins->op];                                                 \
+    } while (0)
+
+    if (chip->keyboard.waiting)
+        goto done;
+    DISPATCH();
+
+op_odd:
+    chip8_Step(chip);
+    if (chip->keyboard.waiting)
+        goto done;
+    DISPATCH();
+op_decode:
+    chip8_DecodeInstruction( chip8_FetchInstructionMem(&chip->memory, pc), &decoded[pc >> 1]);
+    goto *labels[ins->op];
+op_handler:
+    // ops with more involved semantics run the interpreter handler,
+    // Fx0A among them may start a key wait
+    chip8_GetHandler(ins->op)(chip, ins);
+    if (chip->keyboard.waiting)
+        goto done;
+    DISPATCH();
+op_nop:
+    DISPATCH();
+op_jp:
+    r->PC = ins->nnn;
+    DISPATCH();
+op_se_vx_kk:
+    if (V[ins->x] == ins->kk)
+        r->PC += 2;
+    DISPATCH();
+op_sne_vx_kk:
+    if (V[ins->x] != ins->kk)
+        r->PC += 2;
+    DISPATCH();
+op_se_vx_vy:
+    if (V[ins->x] == V[ins->y])
+        r->PC += 2;
+    DISPATCH();
+op_sne_vx_vy:
+    if (V[ins->x] != V[ins->y])
+        r->PC += 2;
+    DISPATCH();
+op_ld_vx_kk:
+    V[ins->x] = ins->kk;
+    DISPATCH();
+op_add_vx_kk:
+    V[ins->x] += ins->kk;
+    DISPATCH();
+op_ld_vx_vy:
+    V[ins->x] = V[ins->y];
+    DISPATCH();
+op_or:
+    V[ins->x] |= V[ins->y];
+    DISPATCH();
+op_and:
+    V[ins->x] &= V[ins->y];
+    DISPATCH();
+op_xor:
+    V[ins->x] ^= V[ins->y];
+    DISPATCH();
+op_add_vx_vy:
+    {
+        unsigned short temp = V[ins->x] + V[ins->y];
+        V[0x0f] = temp > 0xff;
+        V[ins->x] = temp;
+    }
+    DISPATCH();
+op_sub:
+    V[0x0f] = 0;
+    V[0x0f] = V[ins->x] > V[ins->y];
+    V[ins->x] = V[ins->x] - V[ins->y];
+    DISPATCH();
+op_shr:
+    V[0x0f] = V[ins->x] & 0x01;
+    V[ins->x] /= 2;
+    DISPATCH();
+op_subn:
+    V[0x0f] = V[ins->y] > V[ins->x];
+    V[ins->x] = V[ins->y] - V[ins->x];
+    DISPATCH();
+op_shl:
+    V[0x0f] = V[ins->x] & 0b10000000;
+    V[ins->x] *= 2;
+    DISPATCH();
+op_ld_i:
+    r->I_Register = ins->nnn;
+    DISPATCH();
+op_jp_v0:
+    r->PC = ins->nnn + V[0x00];
+    DISPATCH();
+op_ld_vx_dt:
+    V[ins->x] = r->delay_timer;
+    DISPATCH();
+op_ld_dt_vx:
+    r->delay_timer = V[ins->x];
+    DISPATCH();
+op_ld_st_vx:
+    r->sound_timer = V[ins->x];
+    DISPATCH();
+op_add_i_vx:
+    r->I_Register += V[ins->x];
+    DISPATCH();
+op_ld_f_vx:
+    r->I_Register = V[ins->x] * CHIP8_DEFAULT_SPRITE_HEIGHT;
+    DISPATCH();
+
+#undef DISPATCH
+
+done:
+    return executed;
+}
+
+#else
+
+int chip8_RunThreaded ( chip8 *chip, int cycles) {
+    return chip8_Run(chip, cycles);
+}
+
+#endif
\ No newline at end of file
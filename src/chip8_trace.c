@@ -0,0 +1,123 @@
+#include "../include/chip8_trace.h"
+
+#ifdef CHIP8_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if CHIP8_TRACE_RING_RECORDS & (CHIP8_TRACE_RING_RECORDS - 1)
+#error "CHIP8_TRACE_RING_RECORDS must be a power of two"
+#endif
+
+// Single producer ring, the emulator moves head and the writer moves tail.
+// Both only grow, their difference is the number of records pending.
+struct chip8Trace {
+    FILE *file;
+    pthread_t writer;
+    uint64_t cycle;
+    uint64_t head;
+    uint64_t tail;
+    int stop;
+    chip8TraceRecord ring[CHIP8_TRACE_RING_RECORDS];
+};
+
+//-----------------------------------------------------------------
+// CHIP8 TRACE WRITER
+//-----------------------------------------------------------------
+// Writes the records in [tail, head), in at most two pieces when they wrap
+static void chip8_TraceFlush ( chip8Trace *trace, uint64_t head) {
+    uint64_t tail = trace->tail;
+    while (tail < head) {
+        size_t at = tail & (CHIP8_TRACE_RING_RECORDS - 1);
+        size_t count = head - tail;
+        if (count > CHIP8_TRACE_RING_RECORDS - at)
+            count = CHIP8_TRACE_RING_RECORDS - at;
+        fwrite(&trace->ring[at], sizeof(chip8TraceRecord), count, trace->file);
+        tail += count;
+        __atomic_store_n(&trace->tail, tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void * chip8_TraceWriter ( void *arg) {
+    chip8Trace *trace = arg;
+    for (;;) {
+        int stop = __atomic_load_n(&trace->stop, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+        if (stop) {
+            chip8_TraceFlush(trace, head);
+            return NULL;
+        }
+        if (head - trace->tail >= CHIP8_TRACE_FLUSH_RECORDS)
+            chip8_TraceFlush(trace, head);
+        else
+            usleep(1000);
+    }
+}
+
+//-----------------------------------------------------------------
+// CHIP8 TRACE FUNCTIONS
+//-----------------------------------------------------------------
+chip8Trace * chip8_TraceStart ( chip8 *chip, const char *path) {
+    assert( !chip->trace);
+    chip8Trace *trace = calloc(1, sizeof(chip8Trace));
+    if (!trace)
+        return NULL;
+    trace->file = fopen(path, "wb");
+    if (!trace->file) {
+        free(trace);
+        return NULL;
+    }
+
+    chip8TraceHeader header = { CHIP8_TRACE_MAGIC, CHIP8_TRACE_VERSION, sizeof(chip8TraceRecord), 0 };
+    if (fwrite(&header, sizeof(header), 1, trace->file) != 1
+        || pthread_create(&trace->writer, NULL, chip8_TraceWriter, trace) != 0) {
+        fclose(trace->file);
+        free(trace);
+        return NULL;
+    }
+    chip->trace = trace;
+    return trace;
+}
+
+void chip8_TraceStop ( chip8 *chip) {
+    chip8Trace *trace = chip->trace;
+    if (!trace)
+        return;
+    __atomic_store_n(&trace->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(trace->writer, NULL);
+    fclose(trace->file);
+    free(trace);
+    chip->trace = NULL;
+}
+
+void chip8_TraceBefore ( chip8 *chip, chip8TraceMark *mark) {
+    mark->pc = chip->registers.PC;
+    mark->opcode = chip8_FetchInstructionMem(&chip->memory, mark->pc);
+    memcpy(mark->V, chip->registers.V_Registers, sizeof(mark->V));
+}
+
+void chip8_TraceAfter ( chip8 *chip, const chip8TraceMark *mark) {
+    chip8Trace *trace = chip->trace;
+    chip8TraceRecord record = { trace->cycle++, mark->pc, mark->opcode, chip->registers.I_Register, 0xff, 0 };
+    for (int r = 0; r < 16; r++) {
+        if (chip->registers.V_Registers[r] != mark->V[r]) {
+            record.reg = r;
+            record.value = chip->registers.V_Registers[r];
+            break;
+        }
+    }
+
+    // a full ring waits for the writer rather than dropping records
+    uint64_t head = trace->head;
+    while (head - __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE) == CHIP8_TRACE_RING_RECORDS) {
+        sched_yield();
+    }
+    trace->ring[head & (CHIP8_TRACE_RING_RECORDS - 1)] = record;
+    __atomic_store_n(&trace->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
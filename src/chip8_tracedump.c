@@ -0,0 +1,113 @@
+#include "../include/chip8_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+//-----------------------------------------------------------------
+// CHIP8 TRACE DECODER
+//-----------------------------------------------------------------
+// Prints the records of a trace written by a -DCHIP8_TRACE build, one
+// instruction per line, keeping only those that pass every filter given.
+//
+//   chip8trace <trace> [-pc addr] [-op pattern] [-reg x] [-from cycle] [-to cycle]
+//
+// -pc and -reg take hex, -op takes four opcode digits where anything but a
+// hex digit matches any nibble, e.g. 8xy4 or Dxy5.
+
+typedef struct chip8TraceFilter {
+    long pc;                    // -1 for any
+    unsigned short op_mask;
+    unsigned short op_value;
+    int reg;                    // -1 for any
+    unsigned long long from;
+    unsigned long long to;
+} chip8TraceFilter;
+
+static bool chip8_TraceParsePattern ( const char *pattern, chip8TraceFilter *filter) {
+    if (strlen(pattern) != 4)
+        return false;
+    for (int i = 0; i < 4; i++) {
+        filter->op_mask <<= 4;
+        filter->op_value <<= 4;
+        if (isxdigit((unsigned char) pattern[i])) {
+            char digit[2] = { pattern[i], 0 };
+            filter->op_mask |= 0xf;
+            filter->op_value |= strtol(digit, NULL, 16);
+        }
+    }
+    return true;
+}
+
+static bool chip8_TraceKeep ( const chip8TraceFilter *filter, const chip8TraceRecord *record) {
+    return (filter->pc < 0 || record->pc == filter->pc)
+        && (record->opcode & filter->op_mask) == filter->op_value
+        && (filter->reg < 0 || record->reg == filter->reg)
+        && record->cycle >= filter->from && record->cycle <= filter->to;
+}
+
+static void chip8_TracePrint ( const chip8TraceRecord *record) {
+    printf("%10llu  %03X  %04X  %-12s I=%03X",
+           (unsigned long long) record->cycle, record->pc, record->opcode,
+           chip8_GetOpName(chip8_GetOp(record->opcode)), record->I);
+    if (record->reg != 0xff)
+        printf("  V%X=%02X", record->reg, record->value);
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("[ERROR] usage: chip8trace <trace> [-pc addr] [-op pattern] [-reg x] [-from cycle] [-to cycle]\n");
+        return -1;
+    }
+
+    chip8TraceFilter filter = { -1, 0, 0, -1, 0, ~0ull };
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            printf("[ERROR] %s needs a value \n", argv[i]);
+            return -1;
+        }
+        const char *value = argv[i + 1];
+        if (strcmp(argv[i], "-pc") == 0) {
+            filter.pc = strtol(value, NULL, 16);
+        } else if (strcmp(argv[i], "-op") == 0) {
+            if (!chip8_TraceParsePattern(value, &filter)) {
+                printf("[ERROR] -op needs four opcode digits, e.g. 8xy4 \n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "-reg") == 0) {
+            filter.reg = strtol(value, NULL, 16);
+        } else if (strcmp(argv[i], "-from") == 0) {
+            filter.from = strtoull(value, NULL, 10);
+        } else if (strcmp(argv[i], "-to") == 0) {
+            filter.to = strtoull(value, NULL, 10);
+        } else {
+            printf("[ERROR] unknown option %s \n", argv[i]);
+            return -1;
+        }
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        printf("[ERROR] failed to open %s \n", argv[1]);
+        return -1;
+    }
+    chip8TraceHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, CHIP8_TRACE_MAGIC, 4) != 0
+        || header.version != CHIP8_TRACE_VERSION || header.record_size != sizeof(chip8TraceRecord)) {
+        printf("[ERROR] %s is not a version %d trace of this host \n", argv[1], CHIP8_TRACE_VERSION);
+        fclose(in);
+        return -1;
+    }
+
+    chip8_InitDispatch();
+    chip8TraceRecord records[1024];
+    size_t count;
+    while ((count = fread(records, sizeof(chip8TraceRecord), 1024, in)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (chip8_TraceKeep(&filter, &records[i]))
+                chip8_TracePrint(&records[i]);
+        }
+    }
+    fclose(in);
+    return 0;
+}
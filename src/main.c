@@ -1,7 +1,39 @@
 #include <stdio.h>
-#include <windows.h>
+#include <stdlib.h>
+#include <time.h>
 #include "SDL2/SDL.h"
 #include "chip8.h"
+#include "chip8_render.h"
+#include "chip8_rewind.h"
+#include "chip8_trace.h"
+#include "chip8_jit.h"
+
+// Hot blocks as x86-64 code, the rest on chip8_Run
+static chip8Jit *jit;
+
+static int chip8_JitCore (chip8 *chip, int cycles) {
+    return chip8_JitRun(jit, chip, cycles);
+}
+
+// Interpreter core used by the main loop, build with -DCHIP8_THREADED
+// for the computed-goto core or -DCHIP8_JIT for the JIT
+#ifdef CHIP8_THREADED
+#define chip8_RunCore chip8_RunThreaded
+#elif defined(CHIP8_JIT)
+#define chip8_RunCore chip8_JitCore
+#else
+#define chip8_RunCore chip8_Run
+#endif
+
+// Instructions run per core by -bench, in frames of CHIP8_BENCH_FRAME_CYCLES
+#define CHIP8_BENCH_CYCLES 50000000
+#define CHIP8_BENCH_FRAME_CYCLES 1000
+
+#ifdef CHIP8_TRACE
+#define CHIP8_USAGE "main <rom> [-bench] [-ipf n] [-trace file]"
+#else
+#define CHIP8_USAGE "main <rom> [-bench] [-ipf n]"
+#endif
 
 const char char_map[CHIP8_KEYBOARD_SIZE] = {
     SDLK_0, SDLK_1, SDLK_2, SDLK_3,
@@ -11,6 +43,165 @@ const char char_map[CHIP8_KEYBOARD_SIZE] = {
 
 };
 
+// Stops on an Fx0A wait like the other cores
+static int chip8_StepCore (chip8 *chip, int cycles) {
+    int executed = 0;
+    while (executed < cycles && !chip->keyboard.waiting) {
+        chip8_Step(chip);
+        executed++;
+    }
+    return executed;
+}
+
+// Runs the program headless on each interpreter core and prints emulated MIPS
+static void chip8_BenchCores (const char *buff, long filesize) {
+    static const struct {
+        const char *name;
+        int (*run) (chip8 *chip, int cycles);
+    } cores[] = {
+        { "table dispatch", chip8_StepCore },
+        { "block cache",    chip8_Run },
+        { "threaded",       chip8_RunThreaded },
+        { "jit",            chip8_JitCore },
+    };
+    jit = chip8_JitCreate();
+
+    // one instance, re-initialised for every core
+    static struct chip8 chip;
+    for (size_t i = 0; i < sizeof(cores) / sizeof(cores[0]); i++) {
+        chip8_init(&chip);
+        chip8_KeyboardSetKeyboardMap (&chip.keyboard, char_map);
+        chip8_LoadProgram (&chip, buff, filesize);
+
+        // Cores return early on Fx0A, the next key goes down and comes back
+        // up a frame later so every core runs the same instructions
+        long executed = 0;
+        int key = 0;
+        bool pressed = false;
+        clock_t start = clock();
+        while (executed < CHIP8_BENCH_CYCLES) {
+            long budget = CHIP8_BENCH_CYCLES - executed;
+            executed += cores[i].run(&chip, budget < CHIP8_BENCH_FRAME_CYCLES ? budget : CHIP8_BENCH_FRAME_CYCLES);
+            chip8_TickTimers(&chip);
+            if (pressed) {
+                chip8_PutKeyUp(&chip.keyboard, key);
+                key = (key + 1) % CHIP8_KEYBOARD_SIZE;
+                pressed = false;
+            } else if (chip.keyboard.waiting) {
+                chip8_PutKeyDown(&chip.keyboard, key);
+                pressed = true;
+            }
+        }
+        double seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+        printf("%-16s %8.1f MIPS\n", cores[i].name, executed / seconds / 1e6);
+        chip8_Release(&chip);
+    }
+    chip8_JitDestroy(jit);
+    jit = NULL;
+}
+
+//-------------------------------------------------------------------------
+// BEEP
+//-------------------------------------------------------------------------
+// SDL audio thread: fills the buffer with a square wave, the device is
+// paused while the sound timer is zero
+static void chip8_BeepFill (void *user, Uint8 *stream, int len) {
+    (void) user;
+    static Uint32 phase;
+    const Uint32 half_period = CHIP8_BEEP_SAMPLE_RATE / CHIP8_BEEP_FREQUENCY / 2;
+    Sint16 *samples = (Sint16 *) stream;
+    for (int i = 0; i < len / (int) sizeof(Sint16); i++) {
+        samples[i] = (phase++ / half_period) & 1 ? CHIP8_BEEP_VOLUME : -CHIP8_BEEP_VOLUME;
+    }
+}
+
+// chip8Host sound callback, runs on the emulation thread
+static void chip8_HostSound (void *user, bool on) {
+    SDL_PauseAudioDevice(*(SDL_AudioDeviceID *) user, on ? 0 : 1);
+}
+
+//-------------------------------------------------------------------------
+// EMULATION THREAD
+//-------------------------------------------------------------------------
+// SDL wants the renderer and window events on the main thread, so the
+// game runs here and hands frames over through a chip8FrameQueue. Keys
+// come in as bitmasks of chip8 keys: held is the current state, pressed
+// collects keys that went down since the last frame so a tap shorter than
+// a frame still ends an Fx0A wait.
+typedef struct chip8Emulation {
+    chip8 *chip;
+    chip8Rewind *history;
+    chip8FrameQueue *frames;
+    int instructions_per_frame;
+    Uint32 frame_event;         // pushed after each published frame
+    // shared with the main thread, only through __atomic builtins
+    int running;
+    int rewinding;
+    int held;
+    int pressed;
+} chip8Emulation;
+
+// Brings the chip's keys in line with the masks set by the main thread
+static void chip8_EmulationKeys (chip8Emulation *emu) {
+    chip8Keyboard *keyboard = &emu->chip->keyboard;
+    int pressed = __atomic_exchange_n(&emu->pressed, 0, __ATOMIC_ACQ_REL);
+    int held = __atomic_load_n(&emu->held, __ATOMIC_ACQUIRE);
+    for (int key = 0; key < CHIP8_KEYBOARD_SIZE; key++) {
+        if (pressed >> key & 1)
+            chip8_PutKeyDown(keyboard, key);
+        if (!(held >> key & 1) && chip8_IsKeyDown(keyboard, key))
+            chip8_PutKeyUp(keyboard, key);
+    }
+}
+
+static int chip8_EmulationMain (void *data) {
+    chip8Emulation *emu = data;
+    chip8 *chip = emu->chip;
+
+    // One iteration per frame, paced by the monotonic performance counter
+    const Uint64 ticks_per_second = SDL_GetPerformanceFrequency();
+    const Uint64 ticks_per_frame  = ticks_per_second / CHIP8_FRAME_RATE;
+    Uint64 next_frame = SDL_GetPerformanceCounter();
+    bool first = true;
+
+    while (__atomic_load_n(&emu->running, __ATOMIC_ACQUIRE)) {
+        chip8_EmulationKeys(emu);
+
+        // While rewinding the restored frame replaces running one
+        bool rewound = __atomic_load_n(&emu->rewinding, __ATOMIC_RELAXED) && emu->history && chip8_RewindStep(emu->history, chip);
+        if (!rewound) {
+            // Executing Instructions, the core returns early while Fx0A waits
+            chip8_RunCore( chip, emu->instructions_per_frame);
+
+            // Delay and sound timers, once per frame, the host sound
+            // callback starts and stops the beep
+            chip8_TickTimers(chip);
+
+            if (emu->history)
+                chip8_RewindCapture(emu->history, chip);
+        }
+
+        // Handing the frame to the main thread, skipped when the screen did not change
+        if (chip8_ScreenTakeDirtyRows(&chip->screen) || first) {
+            chip8_FrameQueuePublish(emu->frames, &chip->screen);
+            SDL_Event event = { .type = emu->frame_event };
+            SDL_PushEvent(&event);
+            first = false;
+        }
+
+        // Sleeping once until the next frame is due
+        next_frame += ticks_per_frame;
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now < next_frame) {
+            SDL_Delay((Uint32) ((next_frame - now) * 1000 / ticks_per_second));
+        } else if (now - next_frame > ticks_per_frame) {
+            // more than a frame late, drop the backlog instead of racing to catch up
+            next_frame = now;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
     if (argc < 2) {
@@ -18,6 +209,34 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    //--------------------------------------------------------------------------
+    // Options after the program file
+    //--------------------------------------------------------------------------
+    bool bench = false;
+    int instructions_per_frame = CHIP8_INSTRUCTIONS_PER_FRAME;
+#ifdef CHIP8_TRACE
+    const char *trace_path = NULL;
+#endif
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-bench") == 0) {
+            bench = true;
+        } else if (strcmp(argv[i], "-ipf") == 0 && i + 1 < argc) {
+            instructions_per_frame = atoi(argv[++i]);
+            if (instructions_per_frame <= 0) {
+                printf("[ERROR] -ipf needs a positive instruction count \n");
+                return -1;
+            }
+#ifdef CHIP8_TRACE
+        } else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+#endif
+        } else {
+            printf("[ERROR] unknown option or missing value: %s \n", argv[i]);
+            printf("[ERROR] usage: %s \n", CHIP8_USAGE);
+            return -1;
+        }
+    }
+
     //--------------------------------------------------------------------------
     // Reading Program file
     //--------------------------------------------------------------------------
@@ -31,16 +250,39 @@ int main(int argc, char **argv)
         printf ("[ERROR] failed to read %s \n",filename);
         return -1;
     }
-    printf("------------ buff = %s size = %d \n",buff,filesize);
+    printf("[!] File size : %ld bytes \n",filesize);
+
+    if (bench) {
+        chip8_BenchCores(buff, filesize);
+        return 0;
+    }
 
 //------------------------------------------------------------------------
 // CHIP8 INSTANCE CREATION
 //------------------------------------------------------------------------
     struct chip8 chip8;
     chip8_init(&chip8);
+    // A new RND sequence each game, like the old srand(clock())
+    chip8_Seed(&chip8, time(NULL));
     chip8_KeyboardSetKeyboardMap (&chip8.keyboard, char_map);
     chip8_LoadProgram (&chip8, buff, filesize);
 
+#ifdef CHIP8_TRACE
+    // -trace file records every instruction of the game
+    if (trace_path && !chip8_TraceStart(&chip8, trace_path)) {
+        printf("[ERROR] failed to start the trace %s \n", trace_path);
+        return -1;
+    }
+#endif
+
+#ifdef CHIP8_JIT
+    // NULL without executable memory, chip8_JitRun then interprets
+    jit = chip8_JitCreate();
+#endif
+
+    // Every frame is captured, holding backspace plays them back in reverse
+    chip8Rewind *history = chip8_RewindCreate(CHIP8_REWIND_BYTES, CHIP8_REWIND_FRAMES);
+
 //-------------------------------------------------------------------------
 // Initialising SDL
 //-------------------------------------------------------------------------
@@ -63,95 +305,132 @@ int main(int argc, char **argv)
         printf("[!ERROR} error from window creation : %s \n",SDL_GetError());
     }
 
+//-------------------------------------------------------------------------
+// Opening the beep
+//-------------------------------------------------------------------------
+    // Without an audio device the game runs silent
+    SDL_AudioSpec want = { 0 };
+    want.freq     = CHIP8_BEEP_SAMPLE_RATE;
+    want.format   = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples  = 512;
+    want.callback = chip8_BeepFill;
+    SDL_AudioDeviceID beep = SDL_OpenAudioDevice(NULL, 0, &want, NULL, 0);
+    static chip8Host host = { NULL, NULL, chip8_HostSound };
+    if (beep) {
+        host.user = &beep;
+        chip8_SetHost(&chip8, &host);
+    } else {
+        printf("[!ERROR] error from audio device creation : %s \n", SDL_GetError());
+    }
+
 //-------------------------------------------------------------------------
 // Creating SDL renderer
 //-------------------------------------------------------------------------
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
-    if (!renderer) {
-        printf("[!ERROR] error from renderer creation : %s \n", SDL_GetError());
+    static chip8Emulation emu;
+    SDL_Thread *emulation = NULL;
+    chip8Renderer *renderer = chip8_RendererCreate(window);
+    chip8FrameQueue *frames = chip8_FrameQueueCreate();
+    if (!renderer || !frames) {
+        goto out;
+    }
+
+//-------------------------------------------------------------------------
+// Starting the emulation thread
+//-------------------------------------------------------------------------
+    // Keys are mapped here, the chip's own keyboard belongs to the emulation thread
+    chip8Keyboard input = { 0 };
+    chip8_KeyboardSetKeyboardMap (&input, char_map);
+
+    emu.chip = &chip8;
+    emu.history = history;
+    emu.frames = frames;
+    emu.instructions_per_frame = instructions_per_frame;
+    emu.frame_event = SDL_RegisterEvents(1);
+    emu.running = 1;
+    if (emu.frame_event == (Uint32) -1 ||
+        !(emulation = SDL_CreateThread(chip8_EmulationMain, "chip8 emulation", &emu))) {
+        printf("[!ERROR] error from emulation thread creation : %s \n", SDL_GetError());
+        goto out;
     }
 
 //-------------------------------------------------------------------------
 // MAIN LOOP 
 //-------------------------------------------------------------------------
-    while (1)
+    // Sleeps in SDL_WaitEvent until input arrives or a frame is published
+    const chip8Screen *shown = NULL;
+    SDL_Event event;
+    while (SDL_WaitEvent(&event))
     {
-        //Polling for SDL events
-        SDL_Event event;
-        while (SDL_PollEvent(&event))
+        if (event.type == emu.frame_event) {
+            uint32_t dirty_rows;
+            const chip8Screen *frame = chip8_FrameQueueTake(frames, &dirty_rows);
+            if (frame) {
+                chip8_RendererPresent(renderer, frame, dirty_rows);
+                shown = frame;
+            }
+            continue;
+        }
+        switch (event.type)
         {
-            switch (event.type)
-            {
-            case SDL_QUIT:
-                printf("exiting \n");
-                goto out;
-                break;
-            case SDL_KEYDOWN:
-            {
-                char key = event.key.keysym.sym;
-                int vir_key = chip8_MapKey(&chip8.keyboard, key);
-                if (vir_key > 0) {
-                    chip8_PutKeyDown(&chip8.keyboard, vir_key);
-                }
+        case SDL_QUIT:
+            printf("exiting \n");
+            goto out;
+            break;
+        case SDL_KEYDOWN:
+        {
+            if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                __atomic_store_n(&emu.rewinding, 1, __ATOMIC_RELAXED);
                 break;
             }
-            case SDL_KEYUP:
-            {
-                char key = event.key.keysym.sym;
-                int vir_key = chip8_MapKey(&chip8.keyboard, key);
-                if (vir_key > 0) {
-                    chip8_PutKeyUp(&chip8.keyboard, vir_key);
-                }
-                break;
+            char key = event.key.keysym.sym;
+            int vir_key = chip8_MapKey(&input, key);
+            if (vir_key >= 0) {
+                __atomic_fetch_or(&emu.held, 1 << vir_key, __ATOMIC_RELEASE);
+                __atomic_fetch_or(&emu.pressed, 1 << vir_key, __ATOMIC_RELEASE);
             }
-            default:
+            break;
+        }
+        case SDL_KEYUP:
+        {
+            if (event.key.keysym.sym == SDLK_BACKSPACE) {
+                __atomic_store_n(&emu.rewinding, 0, __ATOMIC_RELAXED);
                 break;
             }
-        }
-        // Setting up Renderer
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
-        SDL_RenderClear(renderer);
-        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 0);
-
-        // Displaying pixels 
-        for (int x =0 ; x < WIN_WIDTH; x++) {
-            for (int y = 0; y < WIN_HEIGHT; y++) {
-                if (chip8_IsScreenPixleSet(&chip8.screen, x, y)) {
-                    SDL_Rect r;
-                    r.x = x*WIN_MULTIPLIER;
-                    r.y = y*WIN_MULTIPLIER;
-                    r.w = WIN_MULTIPLIER;
-                    r.h = WIN_MULTIPLIER;
-                    SDL_RenderFillRect(renderer, &r);
-                }
+            char key = event.key.keysym.sym;
+            int vir_key = chip8_MapKey(&input, key);
+            if (vir_key >= 0) {
+                __atomic_fetch_and(&emu.held, ~(1 << vir_key), __ATOMIC_RELEASE);
             }
+            break;
         }
-        SDL_RenderPresent(renderer);
-        
-        // Delay timer
-        if (chip8.registers.delay_timer > 0) {
-        /*TODO: Right now need to change timer value for each game separately,
-           need to figure out a standard value for each game*/
-            Sleep(70);
-            chip8.registers.delay_timer -= 1;
-        }
-
-        // Sound timer
-        if (chip8.registers.sound_timer > 0) {
-            // TODO: Beep not working 
-            //Beep(15000, 100 );
-            chip8.registers.sound_timer -= 1;
-            
+        case SDL_WINDOWEVENT:
+            // the texture still holds the last frame taken
+            if (event.window.event == SDL_WINDOWEVENT_EXPOSED && shown)
+                chip8_RendererPresent(renderer, shown, 0);
+            break;
+        default:
+            break;
         }
-        // Fetching Instruction
-        unsigned short opcode = chip8_FetchInstructionMem(&chip8.memory, chip8.registers.PC);
-        chip8.registers.PC += 2;
-        chip8_ExecuteInstruction( &chip8, opcode);
     }
 
 
 
 out:
+    if (emulation) {
+        __atomic_store_n(&emu.running, 0, __ATOMIC_RELEASE);
+        SDL_WaitThread(emulation, NULL);
+    }
+    if (beep)
+        SDL_CloseAudioDevice(beep);
+#ifdef CHIP8_TRACE
+    chip8_TraceStop(&chip8);
+#endif
+    chip8_RewindDestroy(history);
+    chip8_JitDestroy(jit);
+    chip8_Release(&chip8);
+    chip8_FrameQueueDestroy(frames);
+    chip8_RendererDestroy(renderer);
     SDL_DestroyWindow(window);
     return 0;
 }
\ No newline at end of file